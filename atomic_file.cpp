@@ -0,0 +1,132 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   atomic_file.cpp
+ *
+ * rename() within a directory is atomic, so the original name always points
+ * at either the old or the complete new file. The data is synced before the
+ * rename and the directory after it, otherwise a crash may still leave an
+ * empty file behind the new name.
+ */
+
+#include "atomic_file.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+std::runtime_error system_error(const std::string &what, const std::string &path) {
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+std::string directory_of(const std::string &path) {
+    auto slash = path.find_last_of('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+
+/**
+ * The file a symlink points to, so the link stays and its target is replaced.
+ */
+std::string resolved(const std::string &path) {
+    auto real = realpath(path.c_str(), nullptr);
+    if (!real) {
+        return path;
+    }
+    std::string target(real);
+    std::free(real);
+    return target;
+}
+
+}
+
+AtomicFile::AtomicFile(const std::string &path, bool keep_times) : path(resolved(path)), keep_times(keep_times) {
+    if (stat(this->path.c_str(), &original) != 0) {
+        if (errno != ENOENT) {
+            throw system_error("Could not stat", this->path);
+        }
+        existed = false;
+    }
+    auto slash = this->path.find_last_of('/');
+    auto name = slash == std::string::npos ? this->path : this->path.substr(slash + 1);
+    auto pattern = directory_of(this->path) + "/." + name + ".XXXXXX";
+    std::vector<char> buffer(pattern.begin(), pattern.end());
+    buffer.push_back('\0');
+    fd = mkstemp(buffer.data());
+    if (fd < 0) {
+        throw system_error("Could not create a file next to", this->path);
+    }
+    temp = buffer.data();
+    if (!existed) {
+        return;
+    }
+    // mkstemp makes it 0600
+    if (fchmod(fd, original.st_mode & 07777) != 0) {
+        auto error = system_error("Could not set the mode of", temp);
+        close(fd);
+        fd = -1;
+        unlink(temp.c_str());
+        throw error;
+    }
+    // only works for root or our own group, a new owner is fine otherwise
+    if (fchown(fd, original.st_uid, original.st_gid) != 0) {
+#ifdef DEBUG_EOM
+        std::perror(temp.c_str());
+#endif
+    }
+}
+
+AtomicFile::~AtomicFile() {
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!committed) {
+        unlink(temp.c_str());
+    }
+}
+
+void AtomicFile::commit() {
+    // any descriptor of the file syncs what the writers put in it
+    if (fsync(fd) != 0) {
+        throw system_error("Could not sync", temp);
+    }
+    if (keep_times && existed) {
+        timespec times[2] = {original.st_atim, original.st_mtim};
+        if (futimens(fd, times) != 0) {
+            throw system_error("Could not set the times of", temp);
+        }
+    }
+    auto closed = close(fd);
+    fd = -1;
+    if (closed != 0) {
+        throw system_error("Could not close", temp);
+    }
+    if (rename(temp.c_str(), path.c_str()) != 0) {
+        throw system_error("Could not replace", path);
+    }
+    committed = true;
+
+    auto directory = directory_of(path);
+    auto directory_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (directory_fd >= 0) {
+        fsync(directory_fd);
+        close(directory_fd);
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   atomic_file.h
+ */
+
+#ifndef EOM_ATOMIC_FILE_H
+#define EOM_ATOMIC_FILE_H
+
+#include <string>
+#include <sys/stat.h>
+
+/**
+ * Replaces a file without ever leaving it half written. The new contents go
+ * to temp_path(), a fresh file in the same directory, which commit() syncs
+ * and renames over the original. Until then, or if the AtomicFile is
+ * dropped without commit(), the original is untouched and the temporary
+ * file is removed.
+ */
+struct AtomicFile {
+    /**
+     * A path that does not exist yet is created, readable by its owner only.
+     * A symlink is followed, the file it points to is replaced and the link stays.
+     *
+     * @param keep_times give the new file the access and modification times of the original
+     * @throws std::runtime_error if path can't be read or its directory written
+     */
+    explicit AtomicFile(const std::string &path, bool keep_times = false);
+
+    AtomicFile(const AtomicFile &) = delete;
+
+    AtomicFile &operator=(const AtomicFile &) = delete;
+
+    ~AtomicFile();
+
+    /**
+     * Write here, by name. The file already exists with the mode of the original.
+     */
+    [[nodiscard]]
+    const std::string &temp_path() const {
+        return temp;
+    }
+
+    /**
+     * @throws std::runtime_error if the new contents could not be made durable,
+     * the original is untouched then
+     */
+    void commit();
+
+    std::string path;
+    std::string temp;
+    struct stat original{};
+    bool existed = true;
+    bool keep_times;
+    int fd = -1;
+    bool committed = false;
+};
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   dir_scanner.cpp
+ *
+ * readdir() hands out the file type with the name on most file systems, so
+ * a directory costs one getdents64 call per few hundred entries and no stat
+ * per file. Only file systems without d_type and symbolic links get a stat.
+ */
+
+#include "dir_scanner.h"
+
+#include <algorithm>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace {
+
+std::string join(const std::string &directory, const std::string &name) {
+    return directory.back() == '/' ? directory + name : directory + "/" + name;
+}
+
+}
+
+unsigned char file_type(int directory_fd, const dirent &entry) {
+    auto type = entry.d_type;
+    struct stat status{};
+    if (type == DT_UNKNOWN) {
+        if (fstatat(directory_fd, entry.d_name, &status, AT_SYMLINK_NOFOLLOW) != 0) {
+            return DT_UNKNOWN;
+        }
+        type = S_ISREG(status.st_mode) ? DT_REG : S_ISDIR(status.st_mode) ? DT_DIR :
+                                                  S_ISLNK(status.st_mode) ? DT_LNK : DT_UNKNOWN;
+    }
+    if (type == DT_LNK) {
+        if (fstatat(directory_fd, entry.d_name, &status, 0) != 0 || !S_ISREG(status.st_mode)) {
+            return DT_UNKNOWN;
+        }
+        type = DT_REG;
+    }
+    if (type != DT_REG && type != DT_DIR) {
+        return DT_UNKNOWN;
+    }
+    return type;
+}
+
+void DirScanner::scan(const std::string &root, Filter accept, Sink sink, std::function<void()> done,
+                      Known earlier, Visit entering) {
+    cancel();
+    filter = std::move(accept);
+    on_batch = std::move(sink);
+    on_done = std::move(done);
+    known = std::move(earlier);
+    visit = std::move(entering);
+    stopping = false;
+    queues.clear();
+    for (unsigned i = 0; i < std::max(1u, thread_count); i++) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    queues[0]->directories.push_back(root);
+    queued = 1;
+    pending = 1;
+    for (size_t i = 0; i < queues.size(); i++) {
+        threads.emplace_back(&DirScanner::work, this, i);
+    }
+}
+
+void DirScanner::cancel() {
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        stopping = true;
+    }
+    idle.notify_all();
+    finish();
+}
+
+void DirScanner::finish() {
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    threads.clear();
+}
+
+void DirScanner::work(size_t self) {
+    for (;;) {
+        std::string directory;
+        if (pop(self, directory) || steal(self, directory)) {
+            if (!stopping) {
+                read_directory(self, directory);
+            }
+            if (--pending == 0) {
+                {
+                    std::lock_guard<std::mutex> lock(idle_mutex);
+                }
+                idle.notify_all();
+                if (!stopping && on_done) {
+                    on_done();
+                }
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        idle.wait(lock, [this] {
+            return stopping || pending == 0 || queued > 0;
+        });
+        if (stopping || pending == 0) {
+            return;
+        }
+    }
+}
+
+bool DirScanner::pop(size_t self, std::string &directory) {
+    auto &queue = *queues[self];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.directories.empty()) {
+        return false;
+    }
+    // newest first, its parent was just read so it is likely cached
+    directory = std::move(queue.directories.back());
+    queue.directories.pop_back();
+    queued--;
+    return true;
+}
+
+bool DirScanner::steal(size_t self, std::string &directory) {
+    for (size_t i = 1; i < queues.size(); i++) {
+        auto &queue = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.directories.empty()) {
+            continue;
+        }
+        // oldest, the top of the largest unexplored branch
+        directory = std::move(queue.directories.front());
+        queue.directories.pop_front();
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void DirScanner::push(size_t self, std::string directory) {
+    pending++;
+    {
+        auto &queue = *queues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.directories.push_back(std::move(directory));
+        queued++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+    }
+    idle.notify_one();
+}
+
+void DirScanner::read_directory(size_t self, const std::string &directory) {
+    if (visit) {
+        visit(directory);
+    }
+    // the time from before reading, a change while reading makes it stale
+    struct stat status{};
+    if (stat(directory.c_str(), &status) != 0) {
+        return;
+    }
+    Batch batch{directory, {}, {}, status.st_mtim};
+    if (!(known && known(directory, batch.modified, batch)) && !read_entries(directory, batch)) {
+        return;
+    }
+    for (auto &name: batch.subdirectories) {
+        push(self, join(directory, name));
+    }
+    if (stopping) {
+        return;
+    }
+    on_batch(std::move(batch));
+}
+
+bool DirScanner::read_entries(const std::string &directory, Batch &batch) {
+    auto stream = opendir(directory.c_str());
+    if (!stream) {
+        return false;
+    }
+    auto fd = dirfd(stream);
+    while (auto entry = readdir(stream)) {
+        if (stopping) {
+            break;
+        }
+        auto dots = entry->d_name[0] == '.' &&
+                    (entry->d_name[1] == 0 || (entry->d_name[1] == '.' && entry->d_name[2] == 0));
+        if (dots) {
+            continue;
+        }
+        auto type = file_type(fd, *entry);
+        if (type == DT_UNKNOWN) {
+            continue;
+        }
+        if (type == DT_DIR) {
+            batch.subdirectories.emplace_back(entry->d_name);
+        } else if (filter(fd, entry->d_name)) {
+            batch.names.emplace_back(entry->d_name);
+        }
+    }
+    closedir(stream);
+    std::sort(batch.names.begin(), batch.names.end());
+    return true;
+}
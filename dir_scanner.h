@@ -0,0 +1,155 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   dir_scanner.h
+ */
+
+#ifndef EOM_DIR_SCANNER_H
+#define EOM_DIR_SCANNER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <ctime>
+
+#include <dirent.h>
+
+/**
+ * Type of a directory entry, symbolic links to files count as files.
+ *
+ * @return DT_REG, DT_DIR, or DT_UNKNOWN for anything else
+ */
+unsigned char file_type(int directory_fd, const dirent &entry);
+
+/**
+ * Walks a directory tree on several threads. Each thread works depth first
+ * on its own queue of directories and steals from the others when it runs
+ * dry, so one deep branch never leaves the other threads idle.
+ *
+ * Symbolic links to files are followed, links to directories are not, which
+ * keeps cycles out.
+ */
+struct DirScanner {
+    /**
+     * What was found in one directory: the accepted files, sorted by name,
+     * and the subdirectories. Every directory read gets one, even without
+     * accepted files.
+     */
+    struct Batch {
+        std::string directory;
+        std::vector<std::string> names;
+        std::vector<std::string> subdirectories;
+        /**
+         * Modification time of the directory before it was read.
+         */
+        timespec modified{};
+    };
+    /**
+     * Decides on a file name, without the directory. Called on many threads
+     * at once. name is NUL terminated and only valid during the call,
+     * directory_fd is the open directory it is in.
+     */
+    using Filter = std::function<bool(int directory_fd, std::string_view name)>;
+    /**
+     * Gets every directory with accepted files, called on the scanning threads.
+     */
+    using Sink = std::function<void(Batch batch)>;
+    /**
+     * Fills in names and subdirectories of a directory from an earlier scan
+     * and returns true if they are still valid for its modification time,
+     * then the directory is not read. Called on many threads at once.
+     */
+    using Known = std::function<bool(const std::string &directory, const timespec &modified, Batch &batch)>;
+    /**
+     * Called for each directory before it is looked at, on the scanning
+     * threads. A watch set up here sees what changes while it is read.
+     */
+    using Visit = std::function<void(const std::string &directory)>;
+
+    explicit DirScanner(unsigned thread_count) : thread_count(thread_count) {}
+
+    DirScanner(const DirScanner &) = delete;
+
+    DirScanner &operator=(const DirScanner &) = delete;
+
+    ~DirScanner() {
+        cancel();
+    }
+
+    /**
+     * Starts scanning root, cancelling any scan still running. on_done runs
+     * on a scanning thread after the last batch, unless cancelled.
+     */
+    void scan(const std::string &root, Filter filter, Sink on_batch, std::function<void()> on_done,
+              Known known = nullptr, Visit visit = nullptr);
+
+    /**
+     * Stops the scan and waits for its threads. Batches may still arrive
+     * until this returns.
+     */
+    void cancel();
+
+    /**
+     * Waits for the threads of a scan that is done.
+     */
+    void finish();
+
+    [[nodiscard]]
+    bool busy() const {
+        return !threads.empty();
+    }
+
+private:
+    struct Queue {
+        std::deque<std::string> directories;
+        std::mutex mutex;
+    };
+
+    void work(size_t self);
+
+    bool pop(size_t self, std::string &directory);
+
+    bool steal(size_t self, std::string &directory);
+
+    void push(size_t self, std::string directory);
+
+    void read_directory(size_t self, const std::string &directory);
+
+    /**
+     * @return false if directory can't be read
+     */
+    bool read_entries(const std::string &directory, Batch &batch);
+
+    unsigned thread_count;
+    Filter filter;
+    Sink on_batch;
+    std::function<void()> on_done;
+    Known known;
+    Visit visit;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    /**
+     * Directories waiting in the queues, and those not yet fully read.
+     */
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> pending{0};
+    std::atomic<bool> stopping{false};
+    std::mutex idle_mutex;
+    std::condition_variable idle;
+};
+
+#endif
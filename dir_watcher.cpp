@@ -0,0 +1,202 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   dir_watcher.cpp
+ *
+ * fanotify could follow a whole file system with one mark, but needs
+ * CAP_SYS_ADMIN, so each directory gets an inotify watch instead.
+ */
+
+#include "dir_watcher.h"
+#include "path_util.h"
+
+#include <cstdio>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE |
+                                IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+std::string join(const std::string &directory, const std::string &name) {
+    return directory.back() == '/' ? directory + name : directory + "/" + name;
+}
+
+}
+
+void DirWatcher::start(Filter accept, Sink sink) {
+    stop();
+    filter = std::move(accept);
+    on_change = std::move(sink);
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotify_fd < 0 || wake_fd < 0) {
+#ifdef DEBUG_EOM
+        std::perror("inotify");
+#endif
+        stop();
+        return;
+    }
+    thread = std::thread(&DirWatcher::work, this);
+}
+
+void DirWatcher::stop() {
+    if (thread.joinable()) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+#ifdef DEBUG_EOM
+            std::perror("eventfd");
+#endif
+        }
+        thread.join();
+    }
+    // closing the inotify descriptor drops every watch
+    for (auto fd: {&inotify_fd, &wake_fd}) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    directories.clear();
+}
+
+void DirWatcher::watch(const std::string &directory) {
+    if (inotify_fd < 0) {
+        return;
+    }
+    auto wd = inotify_add_watch(inotify_fd, directory.c_str(), WATCH_MASK);
+    if (wd < 0) {
+        // ENOSPC once max_user_watches is used up
+#ifdef DEBUG_EOM
+        std::perror(directory.c_str());
+#endif
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    directories[wd] = directory;
+}
+
+void DirWatcher::work() {
+    // aligned for inotify_event, room for many events per read
+    std::vector<uint64_t> buffer(8192);
+    pollfd fds[] = {{inotify_fd, POLLIN, 0},
+                    {wake_fd,    POLLIN, 0}};
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            continue;
+        }
+        if (fds[1].revents) {
+            return;
+        }
+        auto size = read(inotify_fd, buffer.data(), buffer.size() * sizeof(buffer[0]));
+        if (size <= 0) {
+            continue;
+        }
+        auto bytes = reinterpret_cast<const char *>(buffer.data());
+        for (ssize_t offset = 0; offset < size;) {
+            auto &event = *reinterpret_cast<const inotify_event *>(bytes + offset);
+            handle(event);
+            offset += ssize_t(sizeof(inotify_event) + event.len);
+        }
+    }
+}
+
+void DirWatcher::handle(const inotify_event &event) {
+    if (event.mask & IN_Q_OVERFLOW) {
+#ifdef DEBUG_EOM
+        std::fprintf(stderr, "inotify queue overflow\n");
+#endif
+        on_change({Change::OVERFLOWED, {}, {}, 0});
+        return;
+    }
+    std::string directory;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = directories.find(event.wd);
+        if (found == directories.end()) {
+            return;
+        }
+        if (event.mask & IN_IGNORED) {
+            directories.erase(found);
+            return;
+        }
+        directory = found->second;
+    }
+    if (event.len == 0) {
+        return;
+    }
+    std::string name(event.name);
+    if (event.mask & IN_ISDIR) {
+        if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+            add_tree(join(directory, name));
+        } else if (event.mask & (IN_DELETE | IN_MOVED_FROM)) {
+            auto path = join(directory, name);
+            forget_tree(path);
+            on_change({Change::DIRECTORY_REMOVED, path, {}, 0});
+        }
+        return;
+    }
+    // hidden files written in place are mostly temporary files of atomic
+    // saves, ours included, they are reported when renamed into place
+    auto temporary = name[0] == '.' && (event.mask & IN_CLOSE_WRITE);
+    if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        if (!temporary && filter(AT_FDCWD, join(directory, name))) {
+            on_change({Change::WRITTEN, directory, name, event.cookie});
+        }
+    } else if (event.mask & (IN_DELETE | IN_MOVED_FROM)) {
+        on_change({Change::REMOVED, directory, name, event.cookie});
+    }
+}
+
+void DirWatcher::add_tree(const std::string &directory) {
+    // watch first, a file added while reading is then seen at least once
+    watch(directory);
+    auto stream = opendir(directory.c_str());
+    if (!stream) {
+        return;
+    }
+    auto fd = dirfd(stream);
+    std::vector<std::string> subdirectories;
+    while (auto entry = readdir(stream)) {
+        auto dots = entry->d_name[0] == '.' &&
+                    (entry->d_name[1] == 0 || (entry->d_name[1] == '.' && entry->d_name[2] == 0));
+        if (dots) {
+            continue;
+        }
+        auto type = file_type(fd, *entry);
+        if (type == DT_DIR) {
+            subdirectories.emplace_back(entry->d_name);
+        } else if (type == DT_REG && filter(fd, entry->d_name)) {
+            on_change({Change::WRITTEN, directory, entry->d_name, 0});
+        }
+    }
+    closedir(stream);
+    for (auto &name: subdirectories) {
+        add_tree(join(directory, name));
+    }
+}
+
+void DirWatcher::forget_tree(const std::string &directory) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = directories.begin(); it != directories.end();) {
+        if (is_within(it->second, directory)) {
+            inotify_rm_watch(inotify_fd, it->first);
+            it = directories.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,126 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   dir_watcher.h
+ */
+
+#ifndef EOM_DIR_WATCHER_H
+#define EOM_DIR_WATCHER_H
+
+#include "dir_scanner.h"
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * Follows changes below the directories given to watch() with inotify, on
+ * a thread of its own. New subdirectories are watched and read as they
+ * appear. A file counts as written when it is closed after writing or moved
+ * in, so half written files are not reported.
+ *
+ * inotify needs a watch per directory, a tree with more directories than
+ * fs.inotify.max_user_watches is only partly followed.
+ */
+struct DirWatcher {
+    struct Change {
+        enum Kind {
+            /**
+             * An accepted file was added or rewritten.
+             */
+            WRITTEN,
+            REMOVED,
+            /**
+             * directory and everything below it is gone, name is empty.
+             */
+            DIRECTORY_REMOVED,
+            /**
+             * The kernel dropped events, anything watched may have changed
+             * unseen and has to be read again. directory and name are empty.
+             */
+            OVERFLOWED
+        };
+
+        Kind kind;
+        std::string directory;
+        std::string name;
+        /**
+         * Pairs the REMOVED and WRITTEN of a rename, 0 otherwise.
+         */
+        uint32_t cookie;
+    };
+
+    /**
+     * Decides on written files. For changes directory_fd is AT_FDCWD and
+     * name a whole path, for files found in a new directory as in DirScanner.
+     */
+    using Filter = DirScanner::Filter;
+    /**
+     * Gets the changes, called on the watching thread.
+     */
+    using Sink = std::function<void(Change change)>;
+
+    DirWatcher() = default;
+
+    DirWatcher(const DirWatcher &) = delete;
+
+    DirWatcher &operator=(const DirWatcher &) = delete;
+
+    ~DirWatcher() {
+        stop();
+    }
+
+    /**
+     * Drops all watches and starts over.
+     */
+    void start(Filter filter, Sink on_change);
+
+    /**
+     * Drops all watches, on_change isn't called after this returns.
+     */
+    void stop();
+
+    /**
+     * Watches directory, not its subdirectories. May be called from any
+     * thread between start() and stop().
+     */
+    void watch(const std::string &directory);
+
+private:
+    void work();
+
+    void handle(const struct inotify_event &event);
+
+    /**
+     * Watches a new directory and its subdirectories and reports the files
+     * already in them.
+     */
+    void add_tree(const std::string &directory);
+
+    void forget_tree(const std::string &directory);
+
+    Filter filter;
+    Sink on_change;
+    int inotify_fd = -1;
+    /**
+     * An eventfd that wakes the thread to stop.
+     */
+    int wake_fd = -1;
+    std::thread thread;
+    /**
+     * Watched directories by watch descriptor.
+     */
+    std::unordered_map<int, std::string> directories;
+    std::mutex mutex;
+};
+
+#endif
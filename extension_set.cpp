@@ -0,0 +1,87 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   extension_set.cpp
+ */
+
+#include "extension_set.h"
+
+#include <cstring>
+
+bool ExtensionSet::pack(std::string_view extension, Key &key) {
+    if (extension.empty() || extension.size() > MAX_LENGTH) {
+        return false;
+    }
+    unsigned char bytes[MAX_LENGTH] = {};
+    for (size_t i = 0; i < extension.size(); i++) {
+        auto c = static_cast<unsigned char>(extension[i]);
+        bytes[i] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+    std::memcpy(&key.low, bytes, sizeof(key.low));
+    std::memcpy(&key.high, bytes + sizeof(key.low), sizeof(key.high));
+    return true;
+}
+
+size_t ExtensionSet::hash(const Key &key) {
+    // murmur3 finalizer over both words
+    auto h = key.low ^ (key.high * 0x9e3779b97f4a7c15ull);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return size_t(h);
+}
+
+void ExtensionSet::insert(std::string_view extension) {
+    Key key;
+    if (!pack(extension, key) || contains(extension)) {
+        return;
+    }
+    // at most half full, so probes stay short
+    if (2 * (count + 1) > slots.size()) {
+        grow();
+    }
+    auto mask = slots.size() - 1;
+    auto i = hash(key) & mask;
+    while (!(slots[i] == Key{})) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = key;
+    count++;
+}
+
+bool ExtensionSet::contains(std::string_view extension) const {
+    Key key;
+    if (slots.empty() || !pack(extension, key)) {
+        return false;
+    }
+    auto mask = slots.size() - 1;
+    for (auto i = hash(key) & mask; !(slots[i] == Key{}); i = (i + 1) & mask) {
+        if (slots[i] == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ExtensionSet::grow() {
+    std::vector<Key> old;
+    old.swap(slots);
+    slots.resize(old.empty() ? 16 : 2 * old.size());
+    auto mask = slots.size() - 1;
+    for (auto &key: old) {
+        if (key == Key{}) {
+            continue;
+        }
+        auto i = hash(key) & mask;
+        while (!(slots[i] == Key{})) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = key;
+    }
+}
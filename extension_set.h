@@ -0,0 +1,75 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   extension_set.h
+ */
+
+#ifndef EOM_EXTENSION_SET_H
+#define EOM_EXTENSION_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/**
+ * Case insensitive set of file name extensions. An extension is packed
+ * lowercased into two 64 bit words, so a lookup is a hash and one or two
+ * integer compares in an open addressed table, without allocating.
+ *
+ * Fill it before sharing it, lookups are safe from any number of threads.
+ */
+struct ExtensionSet {
+    /**
+     * Longer extensions are never matched.
+     */
+    static constexpr size_t MAX_LENGTH = 16;
+
+    void insert(std::string_view extension);
+
+    [[nodiscard]]
+    bool contains(std::string_view extension) const;
+
+    /**
+     * @param name a file name without directory
+     * @return true if the part after the last dot is in the set
+     */
+    [[nodiscard]]
+    bool matches(std::string_view name) const {
+        auto dot = name.find_last_of('.');
+        return dot != std::string_view::npos && contains(name.substr(dot + 1));
+    }
+
+private:
+    struct Key {
+        uint64_t low = 0;
+        uint64_t high = 0;
+
+        bool operator==(const Key &other) const {
+            return low == other.low && high == other.high;
+        }
+    };
+
+    /**
+     * @return false if extension is empty or too long
+     */
+    static bool pack(std::string_view extension, Key &key);
+
+    static size_t hash(const Key &key);
+
+    void grow();
+
+    /**
+     * An all zero key marks a free slot, no extension packs to that.
+     */
+    std::vector<Key> slots;
+    size_t count = 0;
+};
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   file_list.cpp
+ */
+
+#include "file_list.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <unordered_set>
+
+template<typename T>
+T &FileList::Chunks<T>::slot(size_t i) {
+    auto chunk = i / CHUNK_SIZE;
+    if (chunk >= MAX_CHUNKS) {
+        throw std::length_error("FileList is full");
+    }
+    if (!chunks[chunk]) {
+        chunks[chunk] = std::make_unique<std::array<T, CHUNK_SIZE>>();
+    }
+    return (*chunks[chunk])[i % CHUNK_SIZE];
+}
+
+template<typename T>
+void FileList::Chunks<T>::clear(size_t used) {
+    for (size_t i = 0; i < (used + CHUNK_SIZE - 1) / CHUNK_SIZE; i++) {
+        chunks[i].reset();
+    }
+}
+
+namespace {
+
+/**
+ * directory with one trailing slash, as the directory table keeps it.
+ */
+std::string as_prefix(std::string_view directory) {
+    std::string prefix(directory);
+    if (!prefix.empty() && prefix.back() != '/') {
+        prefix.push_back('/');
+    }
+    return prefix;
+}
+
+}
+
+FileList::FileList() : blocks(new std::unique_ptr<char[]>[MAX_BLOCKS]) {}
+
+uint32_t FileList::add_directory(std::string_view directory, size_t first) {
+    if (!directory.empty() && directory.back() != '/') {
+        return add_directory(as_prefix(directory), first);
+    }
+    auto used = directory_count.load(std::memory_order_relaxed);
+    if (used > 0 && directories.at(used - 1).prefix == directory) {
+        return uint32_t(used - 1);
+    }
+    auto id = uint32_t(used);
+    auto &slot = directories.slot(used);
+    slot.prefix.assign(directory);
+    slot.first = first;
+    slot.next.store(NO_RUN, std::memory_order_relaxed);
+    auto earlier = last_runs.find(slot.prefix);
+    if (earlier == last_runs.end()) {
+        slot.head = id;
+        slot.previous = NO_RUN;
+        slot.last.store(id, std::memory_order_relaxed);
+        last_runs.emplace(slot.prefix, id);
+    } else {
+        slot.head = directories.at(earlier->second).head;
+        slot.previous = earlier->second;
+    }
+    // readers find the end of the previous run here
+    directory_count.store(used + 1, std::memory_order_release);
+    if (earlier != last_runs.end()) {
+        directories.at(earlier->second).next.store(id, std::memory_order_release);
+        directories.at(slot.head).last.store(id, std::memory_order_release);
+        earlier->second = id;
+    }
+    return id;
+}
+
+uint32_t FileList::add_name(std::string_view name) {
+    // names never straddle two blocks, so a name is one string_view
+    if (arena_used % BLOCK_SIZE + name.size() > BLOCK_SIZE) {
+        arena_used += BLOCK_SIZE - arena_used % BLOCK_SIZE;
+    }
+    auto block = arena_used / BLOCK_SIZE;
+    if (block >= MAX_BLOCKS) {
+        throw std::length_error("FileList is full");
+    }
+    if (!blocks[block]) {
+        blocks[block].reset(new char[BLOCK_SIZE]);
+    }
+    std::memcpy(blocks[block].get() + arena_used % BLOCK_SIZE, name.data(), name.size());
+    auto offset = uint32_t(arena_used);
+    arena_used += name.size();
+    return offset;
+}
+
+size_t FileList::first_file(uint32_t head) const {
+    for (auto id = head; id != NO_RUN; id = directories.at(id).next.load(std::memory_order_acquire)) {
+        if (run_end(id) > directories.at(id).first) {
+            return directories.at(id).first;
+        }
+    }
+    return size();
+}
+
+size_t FileList::last_file(uint32_t head) const {
+    for (auto id = directories.at(head).last.load(std::memory_order_acquire); id != NO_RUN;
+         id = directories.at(id).previous) {
+        if (run_end(id) > directories.at(id).first) {
+            return run_end(id) - 1;
+        }
+    }
+    return size();
+}
+
+uint32_t FileList::other_directory(uint32_t head, bool forward) const {
+    auto runs = directory_count.load(std::memory_order_acquire);
+    for (size_t step = 1; step < runs; step++) {
+        auto id = uint32_t(forward ? (head + step) % runs : (head + runs - step) % runs);
+        if (directories.at(id).head == id && first_file(id) != size()) {
+            return id;
+        }
+    }
+    return head;
+}
+
+size_t FileList::next(size_t i) const {
+    auto id = entry(i).directory;
+    if (i + 1 < run_end(id)) {
+        return i + 1;
+    }
+    for (id = directories.at(id).next.load(std::memory_order_acquire); id != NO_RUN;
+         id = directories.at(id).next.load(std::memory_order_acquire)) {
+        if (run_end(id) > directories.at(id).first) {
+            return directories.at(id).first;
+        }
+    }
+    return next_directory(i);
+}
+
+size_t FileList::previous(size_t i) const {
+    auto id = entry(i).directory;
+    if (i > directories.at(id).first) {
+        return i - 1;
+    }
+    for (id = directories.at(id).previous; id != NO_RUN; id = directories.at(id).previous) {
+        if (run_end(id) > directories.at(id).first) {
+            return run_end(id) - 1;
+        }
+    }
+    return last_file(other_directory(directory_id(i), false));
+}
+
+size_t FileList::next_directory(size_t i) const {
+    return first_file(other_directory(directory_id(i), true));
+}
+
+size_t FileList::previous_directory(size_t i) const {
+    return first_file(other_directory(directory_id(i), false));
+}
+
+size_t FileList::directory_files(size_t i) const {
+    size_t files = 0;
+    for (auto id = directory_id(i); id != NO_RUN; id = directories.at(id).next.load(std::memory_order_acquire)) {
+        auto &run = directories.at(id);
+        files += run_end(id) - run.first - run.removed;
+    }
+    return files;
+}
+
+size_t FileList::directory_position(size_t i) const {
+    auto id = entry(i).directory;
+    auto &run = directories.at(id);
+    auto position = i - run.first;
+    for (auto j = run.first; run.removed && j < i; j++) {
+        position -= entry(j).removed;
+    }
+    for (id = run.previous; id != NO_RUN; id = directories.at(id).previous) {
+        position += run_end(id) - directories.at(id).first - directories.at(id).removed;
+    }
+    return position;
+}
+
+size_t FileList::find(std::string_view directory, std::string_view name) const {
+    auto prefix = as_prefix(directory);
+    uint32_t head;
+    {
+        std::lock_guard<std::mutex> lock(append_mutex);
+        auto last = last_runs.find(prefix);
+        if (last == last_runs.end()) {
+            return size();
+        }
+        head = directories.at(last->second).head;
+    }
+    for (auto id = head; id != NO_RUN; id = directories.at(id).next.load(std::memory_order_acquire)) {
+        for (auto i = directories.at(id).first, end = run_end(id); i < end; i++) {
+            if (!entry(i).removed && this->name(entry(i)) == name) {
+                return i;
+            }
+        }
+    }
+    return size();
+}
+
+void FileList::remove(size_t i) {
+    auto &file = entries.at(i);
+    if (file.removed) {
+        return;
+    }
+    file.removed = true;
+    directories.at(file.directory).removed++;
+}
+
+void FileList::remove_tree(std::string_view directory) {
+    auto prefix = as_prefix(directory);
+    auto runs = directory_count.load(std::memory_order_acquire);
+    for (size_t id = 0; id < runs; id++) {
+        if (directories.at(id).prefix.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        for (auto i = directories.at(id).first, end = run_end(id); i < end; i++) {
+            remove(i);
+        }
+    }
+}
+
+void FileList::push_back(std::string_view path) {
+    auto slash = path.rfind('/');
+    auto split = slash == std::string_view::npos ? 0 : slash + 1;
+    append(path.substr(0, split), {std::string(path.substr(split))});
+}
+
+void FileList::append(std::string_view directory, const std::vector<std::string> &names) {
+    if (names.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(append_mutex);
+    append_locked(directory, names);
+}
+
+void FileList::merge(std::string_view directory, const std::vector<std::string> &names) {
+    if (names.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(append_mutex);
+    auto last = last_runs.find(as_prefix(directory));
+    if (last == last_runs.end()) {
+        append_locked(directory, names);
+        return;
+    }
+    std::unordered_set<std::string_view> known;
+    for (auto id = directories.at(last->second).head; id != NO_RUN;
+         id = directories.at(id).next.load(std::memory_order_relaxed)) {
+        for (auto i = directories.at(id).first, end = run_end(id); i < end; i++) {
+            known.insert(name(entry(i)));
+        }
+    }
+    std::vector<std::string> unknown;
+    for (auto &name: names) {
+        if (!known.count(name)) {
+            unknown.push_back(name);
+        }
+    }
+    if (!unknown.empty()) {
+        append_locked(directory, unknown);
+    }
+}
+
+void FileList::append_locked(std::string_view directory, const std::vector<std::string> &names) {
+    auto size = count.load(std::memory_order_relaxed);
+    auto id = add_directory(directory, size);
+    for (auto &name: names) {
+        if (name.size() > UINT16_MAX) {
+            throw std::length_error("file name too long");
+        }
+        entries.slot(size++) = {id, add_name(name), uint16_t(name.size())};
+    }
+    count.store(size, std::memory_order_release);
+}
+
+void FileList::clear() {
+    std::lock_guard<std::mutex> lock(append_mutex);
+    entries.clear(count.load(std::memory_order_relaxed));
+    // the keys point into the directory table
+    last_runs.clear();
+    directories.clear(directory_count.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < (arena_used + BLOCK_SIZE - 1) / BLOCK_SIZE; i++) {
+        blocks[i].reset();
+    }
+    directory_count.store(0, std::memory_order_relaxed);
+    arena_used = 0;
+    count.store(0, std::memory_order_release);
+}
@@ -0,0 +1,300 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   file_list.h
+ */
+
+#ifndef EOM_FILE_LIST_H
+#define EOM_FILE_LIST_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Index of a file in a FileList, stable until the list is cleared.
+ */
+using FileId = uint32_t;
+
+/**
+ * Append only list of image paths that can be read while other threads
+ * append. Each directory is stored once in a directory table, files are an
+ * entry of a directory id and a name in a shared arena, about 12 bytes plus
+ * the name instead of a whole path. The files added to a directory together
+ * are one run in the list. Files added to it later start another run, the
+ * runs of a directory are chained so next() and previous() go through each
+ * directory whole, in the order the directories first came.
+ *
+ * Files are never taken out, remove() only marks them so indices stay valid.
+ * remove() and the functions that look at removed files belong to a single
+ * thread, they may run while other threads append.
+ *
+ * Everything lives in fixed size chunks that never move, so nothing stays
+ * half visible: appends are published through the size and readers see a
+ * consistent prefix without locking. clear() must not run concurrently with
+ * anything else.
+ */
+struct FileList {
+    static constexpr size_t CHUNK_SIZE = 4096;
+    static constexpr size_t MAX_CHUNKS = 1 << 16;
+    static constexpr size_t BLOCK_SIZE = 1 << 20;
+    static constexpr size_t MAX_BLOCKS = 1 << 12;
+
+    FileList();
+
+    FileList(const FileList &) = delete;
+
+    FileList &operator=(const FileList &) = delete;
+
+    /**
+     * The number of files published so far, more may follow at any time.
+     */
+    [[nodiscard]]
+    size_t size() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]]
+    bool empty() const {
+        return size() == 0;
+    }
+
+    /**
+     * The whole path of file i, less than a size() seen before.
+     */
+    std::string operator[](size_t i) const {
+        auto &file = entry(i);
+        std::string_view prefix = directories.at(file.directory).prefix;
+        std::string path;
+        path.reserve(prefix.size() + file.length);
+        return path.append(prefix).append(name(file));
+    }
+
+    /**
+     * File name of i, without directory.
+     */
+    [[nodiscard]]
+    std::string_view name(size_t i) const {
+        return name(entry(i));
+    }
+
+    /**
+     * The same for all files of a directory, whichever run they are in.
+     */
+    [[nodiscard]]
+    uint32_t directory_id(size_t i) const {
+        return directories.at(entry(i).directory).head;
+    }
+
+    /**
+     * The file after i: the rest of its directory, then the first file of
+     * the next directory, around the list. Removed files are included.
+     */
+    [[nodiscard]]
+    size_t next(size_t i) const;
+
+    [[nodiscard]]
+    size_t previous(size_t i) const;
+
+    /**
+     * First file of the directory after the one of file i, around the list.
+     */
+    [[nodiscard]]
+    size_t next_directory(size_t i) const;
+
+    /**
+     * First file of the directory before the one of file i, around the list.
+     */
+    [[nodiscard]]
+    size_t previous_directory(size_t i) const;
+
+    /**
+     * Files of the directory of i that were not removed, as far as they are
+     * published.
+     */
+    [[nodiscard]]
+    size_t directory_files(size_t i) const;
+
+    /**
+     * Files of the directory of i that come before it and were not removed.
+     */
+    [[nodiscard]]
+    size_t directory_position(size_t i) const;
+
+    /**
+     * Directory of file i, without a trailing slash unless it is the root.
+     */
+    [[nodiscard]]
+    std::string_view directory(size_t i) const {
+        std::string_view prefix = directories.at(entry(i).directory).prefix;
+        return prefix.size() > 1 ? prefix.substr(0, prefix.size() - 1) : prefix;
+    }
+
+    [[nodiscard]]
+    bool removed(size_t i) const {
+        return entry(i).removed;
+    }
+
+    /**
+     * Looks through the files of directory, in all its runs.
+     *
+     * @return the index of a file not removed, or size() if there is none
+     */
+    [[nodiscard]]
+    size_t find(std::string_view directory, std::string_view name) const;
+
+    void remove(size_t i);
+
+    /**
+     * Removes the files in directory and all directories below it.
+     */
+    void remove_tree(std::string_view directory);
+
+    /**
+     * Adds path, to the directory of the last file if it is the same.
+     */
+    void push_back(std::string_view path);
+
+    /**
+     * Adds the files names in directory and publishes them all at once.
+     *
+     * @throws std::length_error if the list is full
+     */
+    void append(std::string_view directory, const std::vector<std::string> &names);
+
+    /**
+     * Like append(), but leaves out the names directory already has, removed
+     * or not. For a scanner that may come after a watcher saw the same files.
+     */
+    void merge(std::string_view directory, const std::vector<std::string> &names);
+
+    void clear();
+
+private:
+    struct Entry {
+        uint32_t directory;
+        uint32_t name;
+        uint16_t length;
+        bool removed = false;
+    };
+
+    static constexpr uint32_t NO_RUN = UINT32_MAX;
+
+    /**
+     * A run of files in one directory, it ends where the next run begins.
+     */
+    struct Directory {
+        /**
+         * With a trailing slash, ready to put in front of a name.
+         */
+        std::string prefix;
+        size_t first = 0;
+        size_t removed = 0;
+        /**
+         * The first run of the directory, and the runs before and after this
+         * one. next is set when a later run is added, so it is published by
+         * itself, like last, which only the first run keeps up to date.
+         */
+        uint32_t head = 0;
+        uint32_t previous = NO_RUN;
+        std::atomic<uint32_t> next{NO_RUN};
+        std::atomic<uint32_t> last{0};
+    };
+
+    /**
+     * Chunked storage for T, slot i exists once it has been published.
+     */
+    template<typename T>
+    struct Chunks {
+        Chunks() : chunks(new std::unique_ptr<std::array<T, CHUNK_SIZE>>[MAX_CHUNKS]) {}
+
+        const T &at(size_t i) const {
+            return (*chunks[i / CHUNK_SIZE])[i % CHUNK_SIZE];
+        }
+
+        T &at(size_t i) {
+            return (*chunks[i / CHUNK_SIZE])[i % CHUNK_SIZE];
+        }
+
+        /**
+         * @throws std::length_error if there are no more chunks
+         */
+        T &slot(size_t i);
+
+        void clear(size_t used);
+
+        std::unique_ptr<std::unique_ptr<std::array<T, CHUNK_SIZE>>[]> chunks;
+    };
+
+    const Entry &entry(size_t i) const {
+        return entries.at(i);
+    }
+
+    std::string_view name(const Entry &file) const {
+        return {blocks[file.name / BLOCK_SIZE].get() + file.name % BLOCK_SIZE, file.length};
+    }
+
+    /**
+     * One past the last file of run id.
+     */
+    size_t run_end(size_t id) const {
+        if (id + 1 < directory_count.load(std::memory_order_acquire)) {
+            return directories.at(id + 1).first;
+        }
+        return size();
+    }
+
+    /**
+     * First and last published file of the directory whose first run is head,
+     * or size() when none is published yet.
+     */
+    size_t first_file(uint32_t head) const;
+
+    size_t last_file(uint32_t head) const;
+
+    /**
+     * The first run of the nearest directory after, or before, the one whose
+     * first run is head that has a published file. head if there is none.
+     */
+    uint32_t other_directory(uint32_t head, bool forward) const;
+
+    /**
+     * Reuses the last run if it has the same directory, otherwise chains a
+     * new run to the runs the directory has. Call with append_mutex held.
+     */
+    uint32_t add_directory(std::string_view directory, size_t first);
+
+    /**
+     * append() with append_mutex held.
+     */
+    void append_locked(std::string_view directory, const std::vector<std::string> &names);
+
+    uint32_t add_name(std::string_view name);
+
+    Chunks<Entry> entries;
+    Chunks<Directory> directories;
+    std::unique_ptr<std::unique_ptr<char[]>[]> blocks;
+    std::atomic<size_t> count{0};
+    std::atomic<size_t> directory_count{0};
+    size_t arena_used = 0;
+    /**
+     * The last run of each directory, by prefix. Guarded by append_mutex.
+     */
+    std::unordered_map<std::string_view, uint32_t> last_runs;
+    mutable std::mutex append_mutex;
+};
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   id_map.h
+ */
+
+#ifndef EOM_ID_MAP_H
+#define EOM_ID_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Map from 32 bit ids to Value in one open addressed array, so a lookup is a
+ * multiply and, mostly, a single compare. Entries are never erased, set them
+ * back to a neutral value instead.
+ */
+template<typename Value>
+struct IdMap {
+    /**
+     * Marks a free slot, can't be used as a key.
+     */
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    /**
+     * Inserts a value initialized Value for id if there is none.
+     */
+    Value &operator[](uint32_t id) {
+        if (2 * (count + 1) > slots.size()) {
+            grow();
+        }
+        auto i = probe(id);
+        if (slots[i].first == EMPTY) {
+            slots[i] = {id, Value()};
+            count++;
+        }
+        return slots[i].second;
+    }
+
+    /**
+     * @return the value of id, or nullptr
+     */
+    const Value *find(uint32_t id) const {
+        if (slots.empty()) {
+            return nullptr;
+        }
+        auto i = probe(id);
+        return slots[i].first == EMPTY ? nullptr : &slots[i].second;
+    }
+
+    /**
+     * Calls f(id, value) for every entry, in no particular order.
+     */
+    template<typename Func>
+    void for_each(Func f) const {
+        for (auto &slot: slots) {
+            if (slot.first != EMPTY) {
+                f(slot.first, slot.second);
+            }
+        }
+    }
+
+    [[nodiscard]]
+    size_t size() const {
+        return count;
+    }
+
+    void clear() {
+        slots.clear();
+        count = 0;
+    }
+
+private:
+    /**
+     * @return the slot of id, or the free slot it would go in
+     */
+    size_t probe(uint32_t id) const {
+        auto mask = slots.size() - 1;
+        // fibonacci hashing, file ids are dense and would cluster otherwise
+        auto i = size_t((uint64_t(id) * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+        while (slots[i].first != EMPTY && slots[i].first != id) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void grow() {
+        std::vector<std::pair<uint32_t, Value>> old(slots.empty() ? 16 : 2 * slots.size(), {EMPTY, Value()});
+        old.swap(slots);
+        for (auto &slot: old) {
+            if (slot.first != EMPTY) {
+                slots[probe(slot.first)] = std::move(slot);
+            }
+        }
+    }
+
+    std::vector<std::pair<uint32_t, Value>> slots;
+    size_t count = 0;
+};
+
+#endif
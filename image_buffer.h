@@ -0,0 +1,43 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   image_buffer.h
+ */
+
+#ifndef EOM_IMAGE_BUFFER_H
+#define EOM_IMAGE_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Interleaved 8 bit pixels, the layout of a Gdk::Pixbuf. channels is 3 or 4.
+ */
+struct ImageBuffer {
+    uint8_t *pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    int rowstride = 0;
+    int channels = 0;
+
+    [[nodiscard]]
+    uint8_t *row(int y) const {
+        return pixels + size_t(y) * size_t(rowstride);
+    }
+
+    /**
+     * Rows [first, last) as an image of their own.
+     */
+    [[nodiscard]]
+    ImageBuffer band(int first, int last) const {
+        return {row(first), width, last - first, rowstride, channels};
+    }
+};
+
+#endif
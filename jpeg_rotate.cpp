@@ -0,0 +1,345 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   jpeg_rotate.cpp
+ *
+ * Turning the image turns every 8x8 block: a quarter turn is a transpose
+ * followed by a mirror, and mirroring a DCT block only flips the sign of its
+ * odd frequencies. Quantization tables and sampling factors are transposed
+ * along with the blocks.
+ *
+ * libjpeg reports errors with longjmp, so no object with a destructor may
+ * live between the setjmp and the end of rotate_jpeg().
+ */
+
+#include "jpeg_rotate.h"
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <jpeglib.h>
+
+namespace {
+
+struct ErrorManager {
+    jpeg_error_mgr manager;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+void error_exit(j_common_ptr info) {
+    auto errors = reinterpret_cast<ErrorManager *>(info->err);
+    info->err->format_message(info, errors->message);
+    std::longjmp(errors->jump, 1);
+}
+
+bool is_quarter_turn(Rotation rotation) {
+    return rotation == Rotation::COUNTERCLOCKWISE || rotation == Rotation::CLOCKWISE;
+}
+
+/**
+ * Whether the right column and the bottom row of MCUs move to the top or
+ * left, where a partial MCU can't go.
+ */
+void moved_edges(Rotation rotation, bool &right, bool &bottom) {
+    right = rotation == Rotation::COUNTERCLOCKWISE || rotation == Rotation::UPSIDE_DOWN;
+    bottom = rotation == Rotation::CLOCKWISE || rotation == Rotation::UPSIDE_DOWN;
+}
+
+/**
+ * Coefficients of the source block that ends up at the destination block,
+ * turned by rotation. Coefficient r * DCTSIZE + c has vertical frequency r.
+ */
+void turn_block(const JCOEF *source, JCOEF *dest, Rotation rotation) {
+    for (int r = 0; r < DCTSIZE; r++) {
+        for (int c = 0; c < DCTSIZE; c++) {
+            switch (rotation) {
+                case Rotation::COUNTERCLOCKWISE:
+                    dest[r * DCTSIZE + c] = JCOEF(r & 1 ? -source[c * DCTSIZE + r] : source[c * DCTSIZE + r]);
+                    break;
+                case Rotation::CLOCKWISE:
+                    dest[r * DCTSIZE + c] = JCOEF(c & 1 ? -source[c * DCTSIZE + r] : source[c * DCTSIZE + r]);
+                    break;
+                case Rotation::UPSIDE_DOWN:
+                    dest[r * DCTSIZE + c] = JCOEF((r + c) & 1 ? -source[r * DCTSIZE + c] : source[r * DCTSIZE + c]);
+                    break;
+                default:
+                    dest[r * DCTSIZE + c] = source[r * DCTSIZE + c];
+            }
+        }
+    }
+}
+
+/**
+ * Fills dest, the blocks of one component already in turned layout, from source.
+ * Both are padded to whole MCUs.
+ */
+void turn_component(j_common_ptr info, jvirt_barray_ptr source, jvirt_barray_ptr dest,
+                    const jpeg_component_info &component, JDIMENSION dest_width, JDIMENSION dest_height,
+                    Rotation rotation) {
+    // in source blocks, padded
+    auto source_width = is_quarter_turn(rotation) ? dest_height : dest_width;
+    auto source_height = is_quarter_turn(rotation) ? dest_width : dest_height;
+    auto dest_rows = JDIMENSION(is_quarter_turn(rotation) ? component.h_samp_factor : component.v_samp_factor);
+    auto dest_columns = JDIMENSION(is_quarter_turn(rotation) ? component.v_samp_factor : component.h_samp_factor);
+
+    for (JDIMENSION dest_y = 0; dest_y < dest_height; dest_y += dest_rows) {
+        auto dest_buffer = info->mem->access_virt_barray(info, dest, dest_y, dest_rows, TRUE);
+        for (JDIMENSION dest_x = 0; dest_x < dest_width; dest_x += dest_columns) {
+            // the source rows of this MCU, dest_columns of them for quarter turns
+            JDIMENSION first_row;
+            switch (rotation) {
+                case Rotation::COUNTERCLOCKWISE:
+                    first_row = dest_x;
+                    break;
+                case Rotation::CLOCKWISE:
+                    first_row = source_height - dest_x - dest_columns;
+                    break;
+                case Rotation::UPSIDE_DOWN:
+                    first_row = source_height - dest_y - dest_rows;
+                    break;
+                default:
+                    first_row = dest_y;
+            }
+            auto rows = is_quarter_turn(rotation) ? dest_columns : dest_rows;
+            auto source_buffer = info->mem->access_virt_barray(info, source, first_row, rows, FALSE);
+            for (JDIMENSION y = dest_y; y < dest_y + dest_rows; y++) {
+                for (JDIMENSION x = dest_x; x < dest_x + dest_columns; x++) {
+                    JDIMENSION source_x;
+                    JDIMENSION source_y;
+                    switch (rotation) {
+                        case Rotation::COUNTERCLOCKWISE:
+                            source_x = source_width - 1 - y;
+                            source_y = x;
+                            break;
+                        case Rotation::CLOCKWISE:
+                            source_x = y;
+                            source_y = source_height - 1 - x;
+                            break;
+                        case Rotation::UPSIDE_DOWN:
+                            source_x = source_width - 1 - x;
+                            source_y = source_height - 1 - y;
+                            break;
+                        default:
+                            source_x = x;
+                            source_y = y;
+                    }
+                    turn_block(source_buffer[source_y - first_row][source_x], dest_buffer[y - dest_y][x], rotation);
+                }
+            }
+        }
+    }
+}
+
+JDIMENSION round_up(JDIMENSION value, int multiple) {
+    return (value + JDIMENSION(multiple) - 1) / JDIMENSION(multiple) * JDIMENSION(multiple);
+}
+
+void transpose(JQUANT_TBL *table) {
+    for (int r = 0; r < DCTSIZE; r++) {
+        for (int c = r + 1; c < DCTSIZE; c++) {
+            std::swap(table->quantval[r * DCTSIZE + c], table->quantval[c * DCTSIZE + r]);
+        }
+    }
+}
+
+/**
+ * Markers the compressor writes itself are not copied, as in jpegtran.
+ */
+bool written_by_compressor(const jpeg_compress_struct &info, jpeg_saved_marker_ptr marker) {
+    auto starts_with = [marker](const char *id, unsigned length) {
+        return marker->data_length >= length && std::memcmp(marker->data, id, length) == 0;
+    };
+    return (info.write_JFIF_header && marker->marker == JPEG_APP0 && starts_with("JFIF", 5)) ||
+           (info.write_Adobe_marker && marker->marker == JPEG_APP0 + 14 && starts_with("Adobe", 5));
+}
+
+/**
+ * Reads an unsigned of size bytes at offset of a TIFF structure in the byte
+ * order it declares.
+ */
+unsigned tiff_get(const JOCTET *tiff, bool big_endian, unsigned offset, int size) {
+    unsigned value = 0;
+    for (int i = 0; i < size; i++) {
+        value |= unsigned(tiff[offset + i]) << 8 * (big_endian ? size - 1 - i : i);
+    }
+    return value;
+}
+
+void tiff_put(JOCTET *tiff, bool big_endian, unsigned offset, int size, unsigned value) {
+    for (int i = 0; i < size; i++) {
+        tiff[offset + i] = JOCTET(value >> 8 * (big_endian ? size - 1 - i : i));
+    }
+}
+
+/**
+ * The pixels are turned now, so the Orientation tag of an APP1 Exif marker
+ * is set to 1, or viewers would turn the image again. The thumbnail in IFD1
+ * would keep the old turn, it is unlinked.
+ */
+void straighten_exif(jpeg_saved_marker_ptr marker) {
+    constexpr unsigned HEADER = 6;
+    if (marker->marker != JPEG_APP0 + 1 || marker->data_length < HEADER + 8 ||
+        std::memcmp(marker->data, "Exif\0\0", HEADER) != 0) {
+        return;
+    }
+    auto tiff = marker->data + HEADER;
+    auto length = marker->data_length - HEADER;
+    bool big_endian;
+    if (std::memcmp(tiff, "MM\0*", 4) == 0) {
+        big_endian = true;
+    } else if (std::memcmp(tiff, "II*\0", 4) == 0) {
+        big_endian = false;
+    } else {
+        return;
+    }
+    auto ifd = tiff_get(tiff, big_endian, 4, 4);
+    if (ifd > length - 6) {
+        return;
+    }
+    auto entries = tiff_get(tiff, big_endian, ifd, 2);
+    if (entries > (length - ifd - 6) / 12) {
+        return;
+    }
+    for (unsigned i = 0; i < entries; i++) {
+        auto entry = ifd + 2 + 12 * i;
+        // a SHORT with count 1 is stored in the value field itself
+        if (tiff_get(tiff, big_endian, entry, 2) == 0x0112 && tiff_get(tiff, big_endian, entry + 2, 2) == 3) {
+            tiff_put(tiff, big_endian, entry + 8, 2, 1);
+        }
+    }
+    tiff_put(tiff, big_endian, ifd + 2 + 12 * entries, 4, 0);
+}
+
+}
+
+bool rotate_jpeg(const std::string &source, const std::string &destination, Rotation rotation, bool trim) {
+    std::FILE *volatile input = std::fopen(source.c_str(), "rb");
+    if (!input) {
+        throw std::runtime_error("Could not open " + source);
+    }
+    // shared by both, libjpeg allows that
+    ErrorManager errors{};
+    jpeg_decompress_struct source_info{};
+    jpeg_compress_struct dest_info{};
+    source_info.err = dest_info.err = jpeg_std_error(&errors.manager);
+    errors.manager.error_exit = error_exit;
+    jpeg_create_decompress(&source_info);
+    jpeg_create_compress(&dest_info);
+    std::FILE *volatile output = nullptr;
+    auto failed = false;
+
+    if (setjmp(errors.jump)) {
+        failed = true;
+    } else {
+        jpeg_stdio_src(&source_info, input);
+        jpeg_save_markers(&source_info, JPEG_COM, 0xFFFF);
+        for (int i = 0; i < 16; i++) {
+            jpeg_save_markers(&source_info, JPEG_APP0 + i, 0xFFFF);
+        }
+        jpeg_read_header(&source_info, TRUE);
+        // like jpegtran -trim, a partial MCU on a moving edge is cut off if allowed
+        bool trim_right;
+        bool trim_bottom;
+        moved_edges(rotation, trim_right, trim_bottom);
+        auto mcu_width = JDIMENSION(source_info.max_h_samp_factor * DCTSIZE);
+        auto mcu_height = JDIMENSION(source_info.max_v_samp_factor * DCTSIZE);
+        auto mcu_columns = source_info.image_width / mcu_width;
+        auto mcu_rows = source_info.image_height / mcu_height;
+        auto partial = (trim_right && source_info.image_width % mcu_width) ||
+                       (trim_bottom && source_info.image_height % mcu_height);
+        if ((partial && !trim) || (trim_right && mcu_columns == 0) || (trim_bottom && mcu_rows == 0)) {
+            jpeg_destroy_compress(&dest_info);
+            jpeg_destroy_decompress(&source_info);
+            std::fclose(input);
+            return false;
+        }
+
+        // the turned arrays have to be requested before the source is read
+        auto common = reinterpret_cast<j_common_ptr>(&source_info);
+        auto quarter_turn = is_quarter_turn(rotation);
+        jvirt_barray_ptr dest_coefficients[MAX_COMPONENTS];
+        JDIMENSION dest_widths[MAX_COMPONENTS];
+        JDIMENSION dest_heights[MAX_COMPONENTS];
+        for (int i = 0; i < source_info.num_components; i++) {
+            auto &component = source_info.comp_info[i];
+            auto width = trim_right ? mcu_columns * JDIMENSION(component.h_samp_factor)
+                                    : round_up(component.width_in_blocks, component.h_samp_factor);
+            auto height = trim_bottom ? mcu_rows * JDIMENSION(component.v_samp_factor)
+                                      : round_up(component.height_in_blocks, component.v_samp_factor);
+            dest_widths[i] = quarter_turn ? height : width;
+            dest_heights[i] = quarter_turn ? width : height;
+            dest_coefficients[i] = source_info.mem->request_virt_barray(
+                    common, JPOOL_IMAGE, FALSE, dest_widths[i], dest_heights[i],
+                    JDIMENSION(quarter_turn ? component.h_samp_factor : component.v_samp_factor));
+        }
+        auto source_coefficients = jpeg_read_coefficients(&source_info);
+
+        jpeg_copy_critical_parameters(&source_info, &dest_info);
+        if (trim_right) {
+            dest_info.image_width = mcu_columns * mcu_width;
+        }
+        if (trim_bottom) {
+            dest_info.image_height = mcu_rows * mcu_height;
+        }
+        if (quarter_turn) {
+            std::swap(dest_info.image_width, dest_info.image_height);
+            for (int i = 0; i < dest_info.num_components; i++) {
+                std::swap(dest_info.comp_info[i].h_samp_factor, dest_info.comp_info[i].v_samp_factor);
+            }
+            for (auto table: dest_info.quant_tbl_ptrs) {
+                if (table) {
+                    transpose(table);
+                }
+            }
+        }
+        dest_info.optimize_coding = TRUE;
+        if (jpeg_has_multiple_scans(&source_info)) {
+            jpeg_simple_progression(&dest_info);
+        }
+        for (int i = 0; i < source_info.num_components; i++) {
+            turn_component(common, source_coefficients[i], dest_coefficients[i], source_info.comp_info[i],
+                           dest_widths[i], dest_heights[i], rotation);
+        }
+        std::fclose(input);
+        input = nullptr;
+
+        output = std::fopen(destination.c_str(), "wb");
+        if (!output) {
+            std::snprintf(errors.message, sizeof(errors.message), "could not write %s", destination.c_str());
+            std::longjmp(errors.jump, 1);
+        }
+        jpeg_stdio_dest(&dest_info, output);
+        jpeg_write_coefficients(&dest_info, dest_coefficients);
+        for (auto marker = source_info.marker_list; marker; marker = marker->next) {
+            if (!written_by_compressor(dest_info, marker)) {
+                straighten_exif(marker);
+                jpeg_write_marker(&dest_info, marker->marker, marker->data, marker->data_length);
+            }
+        }
+        jpeg_finish_compress(&dest_info);
+    }
+
+    jpeg_destroy_compress(&dest_info);
+    jpeg_destroy_decompress(&source_info);
+    if (input) {
+        std::fclose(input);
+    }
+    auto written = !output || std::fclose(output) == 0;
+    if (failed) {
+        throw std::runtime_error(source + ": " + errors.message);
+    }
+    if (!written) {
+        throw std::runtime_error("Could not write " + destination);
+    }
+    return true;
+}
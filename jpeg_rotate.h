@@ -0,0 +1,41 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   jpeg_rotate.h
+ *
+ * Lossless JPEG rotation, the way jpegtran does it: the DCT blocks are moved
+ * and their coefficients transposed or negated, nothing is decoded or
+ * quantized again.
+ */
+
+#ifndef EOM_JPEG_ROTATE_H
+#define EOM_JPEG_ROTATE_H
+
+#include "rotate.h"
+
+#include <string>
+
+/**
+ * Writes the JPEG at source turned by rotation to destination, keeping its
+ * quality and its APPn and COM markers. The Exif orientation is reset and
+ * the Exif thumbnail dropped, they would turn the image a second time.
+ * destination may be source, the source is read completely before
+ * destination is opened.
+ *
+ * A partial MCU on an edge the turn moves to the top or left can't be turned
+ * in place. With trim it is cut off, as jpegtran -trim does, so the image
+ * loses up to 15 pixels on that edge.
+ *
+ * @return false, with nothing written, if there is a partial MCU to cut and
+ * not trim, or the image is narrower than one MCU across that edge
+ * @throws std::runtime_error if the source can't be read or the destination written
+ */
+bool rotate_jpeg(const std::string &source, const std::string &destination, Rotation rotation, bool trim);
+
+#endif
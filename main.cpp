@@ -14,38 +14,401 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <chrono>
 #include <functional>
+#include <cstdint>
 #include <cassert>
 #include <gtkmm-3.0/gtkmm/container.h>
 
 #include <gtkmm-3.0/gtkmm.h>
 #include <gtkmm-3.0/gtkmm/filechooser.h>
+#include "atomic_file.h"
+#include "dir_scanner.h"
+#include "dir_watcher.h"
+#include "extension_set.h"
+#include "file_list.h"
+#include "id_map.h"
+#include "jpeg_rotate.h"
+#include "parallel.h"
+#include "path_util.h"
+#include "resample.h"
+#include "rotate.h"
+#include "scan_index.h"
+#include "sniff.h"
 #include <atomic>
 #include <thread>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
 
 #undef DEBUG_EOM
 
 /**
  * Please don't modify after initialization.
  */
-std::vector<std::string> ALLOWED_EXTENSIONS;
+ExtensionSet ALLOWED_EXTENSIONS;
+/**
+ * Names of the installed gdk-pixbuf loaders, only their signatures are sniffed.
+ */
+ExtensionSet ALLOWED_FORMATS;
+/**
+ * Changes with the installed gdk-pixbuf loaders, which invalidates scan indexes.
+ */
+uint64_t ALLOWED_EXTENSIONS_HASH = ScanIndex::hash({});
 
 void find_allowed_image_formats() {
     auto formats = Gdk::Pixbuf::get_formats();
     for (const auto &format: formats) {
+        ALLOWED_FORMATS.insert(format.get_name().raw());
         auto extensions = format.get_extensions();
         for (const auto &ext: extensions) {
-            ALLOWED_EXTENSIONS.push_back(ext);
+            ALLOWED_EXTENSIONS.insert(ext.raw());
+            ALLOWED_EXTENSIONS_HASH = ScanIndex::hash(ext.raw() + "\n", ALLOWED_EXTENSIONS_HASH);
+        }
+    }
+}
+
+/**
+ * @param name a file name without directory
+ */
+bool has_allowed_extension(std::string_view name) {
+    return ALLOWED_EXTENSIONS.matches(name);
+}
+
+/**
+ * How files are recognized as images, picked with the EOM_FILTER
+ * environment variable.
+ */
+enum class FilterMode {
+    /**
+     * "extension", or unset: by name alone, without touching the file.
+     */
+    EXTENSION,
+    /**
+     * "sniff": known extensions are trusted, other files are recognized by
+     * their first bytes.
+     */
+    SNIFF,
+    /**
+     * "strict": every file is recognized by its first bytes, so misnamed
+     * files never reach a decoder.
+     */
+    STRICT
+};
+
+/**
+ * Please don't modify after initialization.
+ */
+FilterMode FILTER_MODE = FilterMode::EXTENSION;
+
+FilterMode filter_mode_from_environment() {
+    auto mode = Glib::getenv("EOM_FILTER");
+    if (mode == "sniff") {
+        return FilterMode::SNIFF;
+    }
+    if (mode == "strict") {
+        return FilterMode::STRICT;
+    }
+    return FilterMode::EXTENSION;
+}
+
+/**
+ * @param directory_fd directory name is in, or AT_FDCWD if name is a path
+ * @param name NUL terminated
+ */
+bool is_image_file(int directory_fd, std::string_view name) {
+    auto known = has_allowed_extension(base_name(name));
+    switch (FILTER_MODE) {
+        case FilterMode::SNIFF:
+            return known || sniff_image(directory_fd, name.data(), ALLOWED_FORMATS);
+        case FilterMode::STRICT:
+            return sniff_image(directory_fd, name.data(), ALLOWED_FORMATS);
+        default:
+            return known;
+    }
+}
+
+constexpr int TILE_SIZE = 256;
+
+ImageBuffer buffer_of(const Glib::RefPtr<Gdk::Pixbuf> &pixbuf) {
+    return {pixbuf->get_pixels(), pixbuf->get_width(), pixbuf->get_height(), pixbuf->get_rowstride(),
+            pixbuf->get_n_channels()};
+}
+
+/**
+ * source scaled to width x height, see resample().
+ */
+Glib::RefPtr<Gdk::Pixbuf> scaled(const Glib::RefPtr<Gdk::Pixbuf> &source, int width, int height, Filter filter) {
+    auto pixbuf = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, source->get_has_alpha(), 8, width, height);
+    resample(buffer_of(source), buffer_of(pixbuf), 0, 0, double(width) / source->get_width(),
+             double(height) / source->get_height(), filter);
+    return pixbuf;
+}
+
+/**
+ * An image and its successively halved copies, the full image first.
+ */
+using Pyramid = std::vector<Glib::RefPtr<Gdk::Pixbuf>>;
+constexpr int PYRAMID_MIN_SIZE = 64;
+
+Pyramid build_pyramid(const Glib::RefPtr<Gdk::Pixbuf> &source, const std::atomic<bool> &cancelled) {
+    Pyramid levels{source};
+    for (;;) {
+        auto last = levels.back();
+        auto width = last->get_width() / 2;
+        auto height = last->get_height() / 2;
+        if (cancelled || width < PYRAMID_MIN_SIZE || height < PYRAMID_MIN_SIZE) {
+            return levels;
+        }
+        levels.push_back(scaled(last, width, height, Filter::BOX));
+    }
+}
+
+/**
+ * Passes the newest finished pyramid to the GTK thread.
+ */
+struct PyramidMailbox {
+    void post(Pyramid pyramid) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            latest = std::move(pyramid);
         }
+        dispatcher.emit();
+    }
+
+    Pyramid take() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::move(latest);
     }
+
+    Glib::Dispatcher dispatcher;
+    Pyramid latest;
+    std::mutex mutex;
+};
+
+bool is_quarter_turn(Gdk::PixbufRotation rotation) {
+    return rotation == Gdk::PIXBUF_ROTATE_CLOCKWISE || rotation == Gdk::PIXBUF_ROTATE_COUNTERCLOCKWISE;
 }
 
+/**
+ * Shows a pixbuf scaled to draw_width x draw_height and then turned by
+ * rotation, centered when smaller than the allocation. Only the tiles inside
+ * the exposed area get scaled, or cut from the pixbuf when it is shown at its
+ * own size, so memory follows the size of the screen and not the zoom.
+ * Recently drawn tiles are kept for scrolling and turning.
+ */
+struct ImageView : public Gtk::DrawingArea {
+    /**
+     * @param width, height the size on screen, after turning
+     */
+    void set_image(const Glib::RefPtr<Gdk::Pixbuf> &pixbuf, int width, int height, Gdk::PixbufRotation turn) {
+        auto quarter_turn = is_quarter_turn(turn);
+        auto scaled_width = quarter_turn ? height : width;
+        auto scaled_height = quarter_turn ? width : height;
+        if (pixbuf != source || scaled_width != draw_width || scaled_height != draw_height) {
+            tiles.clear();
+            tile_index.clear();
+        }
+        if (pixbuf != source) {
+            levels = {pixbuf};
+        }
+        source = pixbuf;
+        draw_width = scaled_width;
+        draw_height = scaled_height;
+        rotation = turn;
+        set_size_request(width, height);
+        queue_draw();
+    }
+
+    /**
+     * Maps the unturned draw_width x draw_height image at the origin onto its
+     * turned place at the origin. Quarter turns keep pixels on the grid, so
+     * cairo only copies them.
+     */
+    Cairo::Matrix turn_matrix() const {
+        switch (rotation) {
+            case Gdk::PIXBUF_ROTATE_COUNTERCLOCKWISE:
+                return Cairo::Matrix(0, -1, 1, 0, 0, draw_width);
+            case Gdk::PIXBUF_ROTATE_CLOCKWISE:
+                return Cairo::Matrix(0, 1, -1, 0, draw_height, 0);
+            case Gdk::PIXBUF_ROTATE_UPSIDEDOWN:
+                return Cairo::Matrix(-1, 0, 0, -1, draw_width, draw_height);
+            default:
+                return Cairo::identity_matrix();
+        }
+    }
+
+    bool on_draw(const Cairo::RefPtr<Cairo::Context> &cr) override {
+        get_style_context()->render_background(cr, 0, 0, get_allocated_width(), get_allocated_height());
+        if (!source || draw_width < 1 || draw_height < 1) {
+            return true;
+        }
+        auto quarter_turn = is_quarter_turn(rotation);
+        auto left = std::max(0, (get_allocated_width() - (quarter_turn ? draw_height : draw_width)) / 2);
+        auto top = std::max(0, (get_allocated_height() - (quarter_turn ? draw_width : draw_height)) / 2);
+        // from here on everything is in unturned image coordinates
+        cr->translate(left, top);
+        cr->transform(turn_matrix());
+
+        double x1, y1, x2, y2;
+        cr->get_clip_extents(x1, y1, x2, y2);
+        auto first_column = std::max(0, int(x1) / TILE_SIZE);
+        auto first_row = std::max(0, int(y1) / TILE_SIZE);
+        auto last_column = std::min((draw_width - 1) / TILE_SIZE, int(x2) / TILE_SIZE);
+        auto last_row = std::min((draw_height - 1) / TILE_SIZE, int(y2) / TILE_SIZE);
+        if (last_column < first_column || last_row < first_row) {
+            return true;
+        }
+        // twice what is visible, so scrolling back and forth doesn't rescale
+        auto visible = size_t(last_column - first_column + 1) * size_t(last_row - first_row + 1);
+        tile_capacity = std::max(size_t(16), 2 * visible);
+
+        struct Tile {
+            int column;
+            int row;
+            Glib::RefPtr<Gdk::Pixbuf> pixbuf;
+        };
+        std::vector<Tile> drawn;
+        std::vector<Tile> missing;
+        for (auto row = first_row; row <= last_row; row++) {
+            for (auto column = first_column; column <= last_column; column++) {
+                auto tile = cached_tile(column, row);
+                if (!tile && unscaled()) {
+                    tile = source_tile(column, row);
+                    remember_tile(column, row, tile);
+                } else if (!tile) {
+                    tile = new_tile(column, row);
+                    missing.push_back({column, row, tile});
+                }
+                drawn.push_back({column, row, tile});
+            }
+        }
+        // one tile per core at a time
+        parallel_for(int(missing.size()), 1, [this, &missing](int first, int last) {
+            for (auto i = first; i < last; i++) {
+                scale_tile(missing[i].column, missing[i].row, missing[i].pixbuf);
+            }
+        });
+        for (auto &tile: missing) {
+            remember_tile(tile.column, tile.row, tile.pixbuf);
+        }
+
+        for (auto &tile: drawn) {
+            auto x = tile.column * TILE_SIZE;
+            auto y = tile.row * TILE_SIZE;
+            Gdk::Cairo::set_source_pixbuf(cr, tile.pixbuf, x, y);
+            cr->rectangle(x, y, tile.pixbuf->get_width(), tile.pixbuf->get_height());
+            cr->fill();
+        }
+        return true;
+    }
+
+    /**
+     * Use the halved levels of source for scaling down. Ignored if source has
+     * changed since they were requested.
+     */
+    void set_pyramid(const Pyramid &pyramid) {
+        if (pyramid.empty() || pyramid.front() != source) {
+            return;
+        }
+        levels = pyramid;
+        tiles.clear();
+        tile_index.clear();
+        queue_draw();
+    }
+
+    /**
+     * The smallest level still at least as large as the draw size.
+     */
+    const Glib::RefPtr<Gdk::Pixbuf> &level() const {
+        for (auto it = levels.rbegin(); it != levels.rend(); ++it) {
+            if ((*it)->get_width() >= draw_width && (*it)->get_height() >= draw_height) {
+                return *it;
+            }
+        }
+        return levels.front();
+    }
+
+    static uint64_t tile_key(int column, int row) {
+        return (uint64_t(row) << 32) | uint32_t(column);
+    }
+
+    Glib::RefPtr<Gdk::Pixbuf> cached_tile(int column, int row) {
+        auto it = tile_index.find(tile_key(column, row));
+        if (it == tile_index.end()) {
+            return {};
+        }
+        tiles.splice(tiles.begin(), tiles, it->second);
+        return it->second->second;
+    }
+
+    void remember_tile(int column, int row, const Glib::RefPtr<Gdk::Pixbuf> &tile) {
+        auto key = tile_key(column, row);
+        tiles.emplace_front(key, tile);
+        tile_index[key] = tiles.begin();
+        while (tiles.size() > tile_capacity) {
+            tile_index.erase(tiles.back().first);
+            tiles.pop_back();
+        }
+    }
+
+    bool unscaled() const {
+        return source->get_width() == draw_width && source->get_height() == draw_height;
+    }
+
+    Glib::RefPtr<Gdk::Pixbuf> new_tile(int column, int row) const {
+        auto width = std::min(TILE_SIZE, draw_width - column * TILE_SIZE);
+        auto height = std::min(TILE_SIZE, draw_height - row * TILE_SIZE);
+        return Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, level()->get_has_alpha(), 8, width, height);
+    }
+
+    /**
+     * A tile of source shown as it is, sharing its pixels. Cairo converts
+     * only the tiles drawn, not the whole image.
+     */
+    Glib::RefPtr<Gdk::Pixbuf> source_tile(int column, int row) const {
+        auto width = std::min(TILE_SIZE, draw_width - column * TILE_SIZE);
+        auto height = std::min(TILE_SIZE, draw_height - row * TILE_SIZE);
+        return Gdk::Pixbuf::create_subpixbuf(source, column * TILE_SIZE, row * TILE_SIZE, width, height);
+    }
+
+    /**
+     * Only reads the view, safe to run for several tiles at once.
+     */
+    void scale_tile(int column, int row, const Glib::RefPtr<Gdk::Pixbuf> &tile) const {
+        auto &from = level();
+        auto scale_x = double(draw_width) / from->get_width();
+        auto scale_y = double(draw_height) / from->get_height();
+        // bilinear skips source pixels below half size, which only happens before the pyramid is done
+        auto filter = scale_x < 0.5 || scale_y < 0.5 ? Filter::BOX : Filter::BILINEAR;
+        resample(buffer_of(from), buffer_of(tile), column * TILE_SIZE, row * TILE_SIZE, scale_x, scale_y, filter);
+    }
+
+    Glib::RefPtr<Gdk::Pixbuf> source;
+    Pyramid levels;
+    /**
+     * Scaled size before turning, tiles are cut from this.
+     */
+    int draw_width = 0;
+    int draw_height = 0;
+    Gdk::PixbufRotation rotation = Gdk::PIXBUF_ROTATE_NONE;
+    size_t tile_capacity = 16;
+    std::list<std::pair<uint64_t, Glib::RefPtr<Gdk::Pixbuf>>> tiles;
+    std::unordered_map<uint64_t, decltype(tiles)::iterator> tile_index;
+};
+
 struct AppWidgets {
     AppWidgets() = default;
 
-    Gtk::Image *image = nullptr;
+    ImageView *image = nullptr;
     Glib::RefPtr<Gtk::Builder> builder;
-    Glib::RefPtr<Gdk::Pixbuf> pixbuf; // should have adda a pixbufloader
+    Glib::RefPtr<Gdk::Pixbuf> pixbuf; // fully decoded image on screen, see on_image_notify()
     Gtk::ApplicationWindow *main_window = nullptr;
     Gtk::ScrolledWindow *scrolled_window = nullptr;
     Gtk::Viewport *viewport = nullptr;
@@ -59,33 +422,368 @@ struct AppWidgets {
 } app_widgets;
 
 
+/**
+ * Decoded images keyed by path, as stored on disk. Rotations are applied when
+ * drawing. Least recently used images are dropped when the byte budget is
+ * exceeded.
+ *
+ * Shared by the drawing and prefetching threads, all access is locked.
+ */
+struct PixbufCache {
+    /**
+     * A decoded image, possibly decoded smaller than its full_width x full_height.
+     */
+    struct Image {
+        Glib::RefPtr<Gdk::Pixbuf> pixbuf;
+        int full_width = 0;
+        int full_height = 0;
+
+        /**
+         * @return true if pixbuf has at least width x height pixels, or all there are.
+         */
+        [[nodiscard]]
+        bool covers(int width, int height) const {
+            // loaders may round the size down a pixel
+            return pixbuf->get_width() + 1 >= std::min(width, full_width) &&
+                   pixbuf->get_height() + 1 >= std::min(height, full_height);
+        }
+    };
+
+    explicit PixbufCache(size_t byte_budget) : byte_budget(byte_budget) {}
+
+    static size_t bytes(const Image &image) {
+        return size_t(image.pixbuf->get_rowstride()) * size_t(image.pixbuf->get_height());
+    }
+
+    /**
+     * Drops path, call when the file changes on disk.
+     */
+    void forget(const std::string &path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(path);
+        if (it != index.end()) {
+            bytes_used -= bytes(it->second->second);
+            lru.erase(it->second);
+            index.erase(it);
+        }
+    }
+
+    /**
+     * @return the cached image, its pixbuf is empty on a miss. A hit marks the image as recently used.
+     */
+    Image get(const std::string &path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(path);
+        if (it == index.end()) {
+            return {};
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->second;
+    }
+
+    void put(const std::string &path, const Image &image) {
+        auto size = bytes(image);
+        if (size > byte_budget) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(path);
+        if (it != index.end()) {
+            bytes_used -= bytes(it->second->second);
+            lru.erase(it->second);
+            index.erase(it);
+        }
+        while (!lru.empty() && bytes_used + size > byte_budget) {
+            bytes_used -= bytes(lru.back().second);
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+        lru.emplace_front(path, image);
+        index[path] = lru.begin();
+        bytes_used += size;
+    }
+
+    size_t byte_budget;
+    size_t bytes_used = 0;
+    std::list<std::pair<std::string, Image>> lru;
+    std::unordered_map<std::string, decltype(lru)::iterator> index;
+    std::mutex mutex;
+};
+
+Glib::RefPtr<Gdk::Pixbuf> rotated(const Glib::RefPtr<Gdk::Pixbuf> &pixbuf, Gdk::PixbufRotation rotation) {
+    if (rotation == Gdk::PixbufRotation::PIXBUF_ROTATE_NONE) {
+        return pixbuf;
+    }
+    auto quarter_turn = is_quarter_turn(rotation);
+    auto width = quarter_turn ? pixbuf->get_height() : pixbuf->get_width();
+    auto height = quarter_turn ? pixbuf->get_width() : pixbuf->get_height();
+    auto turned = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, pixbuf->get_has_alpha(), 8, width, height);
+    rotate(buffer_of(pixbuf), buffer_of(turned), Rotation(int(rotation)));
+    return turned;
+}
+
+constexpr size_t DECODE_CHUNK_BYTES = 256 << 10;
+constexpr auto PROGRESS_INTERVAL = std::chrono::milliseconds(100);
+
+/**
+ * Streams path through a PixbufLoader in chunks.
+ *
+ * decode_size gets the full size of the image once the header is read and
+ * may shrink the size to decode at, the loader then scales while decoding.
+ * on_progress gets the partially decoded pixbuf as soon as the first
+ * scanlines are in, then at most every PROGRESS_INTERVAL. Both run on the
+ * calling thread while the loader is idle and may be empty.
+ *
+ * @return the decoded image, or an empty RefPtr if cancelled.
+ */
+Glib::RefPtr<Gdk::Pixbuf> decode_progressive(const std::string &path, const std::atomic<bool> &cancelled,
+                                             const std::function<void(int, int, int &, int &)> &decode_size,
+                                             const std::function<void(const Glib::RefPtr<Gdk::Pixbuf> &)> &on_progress) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw Glib::FileError(Glib::FileError::NO_SUCH_ENTITY, "Could not open " + path);
+    }
+    auto loader = Gdk::PixbufLoader::create();
+    loader->signal_size_prepared().connect([&loader, &decode_size](int width, int height) {
+        if (!decode_size) {
+            return;
+        }
+        auto decode_width = width;
+        auto decode_height = height;
+        decode_size(width, height, decode_width, decode_height);
+        if (decode_width > 0 && decode_height > 0 && decode_width < width && decode_height < height) {
+            loader->set_size(decode_width, decode_height);
+        }
+    });
+    std::chrono::steady_clock::time_point last_progress;
+    loader->signal_area_updated().connect([&loader, &last_progress, &on_progress](int, int, int, int) {
+        if (!on_progress) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_progress < PROGRESS_INTERVAL) {
+            return;
+        }
+        last_progress = now;
+        on_progress(loader->get_pixbuf());
+    });
+
+    std::vector<char> chunk(DECODE_CHUNK_BYTES);
+    while (file) {
+        file.read(chunk.data(), std::streamsize(chunk.size()));
+        if (file.gcount() > 0) {
+            loader->write(reinterpret_cast<const guint8 *>(chunk.data()), gsize(file.gcount()));
+        }
+        if (cancelled) {
+            try {
+                loader->close();
+            } catch (Glib::Error &) {
+                // incomplete on purpose
+            }
+            return {};
+        }
+    }
+    loader->close();
+    return loader->get_pixbuf();
+}
+
+/**
+ * Fixed set of decoder threads fed from one queue per lane. Viewport jobs
+ * always run first, then pyramid and prefetch jobs, which never occupy the
+ * last free thread.
+ *
+ * Jobs get a cancellation flag which is raised when the job is superseded.
+ */
+struct DecodePool {
+    enum Lane {
+        VIEWPORT, PYRAMID, PREFETCH, LANES
+    };
+    using Job = std::function<void(const std::atomic<bool> &cancelled)>;
+
+    explicit DecodePool(unsigned thread_count) : thread_count(thread_count) {
+        for (unsigned i = 0; i < thread_count; i++) {
+            threads.emplace_back(&DecodePool::work, this);
+        }
+    }
+
+    ~DecodePool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            for (auto &lane: running) {
+                for (auto &cancelled: lane) {
+                    *cancelled = true;
+                }
+            }
+        }
+        wake.notify_all();
+        for (auto &thread: threads) {
+            thread.join();
+        }
+    }
+
+    void submit(Lane lane, Job job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued[lane].push_back({std::move(job), std::make_shared<std::atomic<bool>>(false)});
+        }
+        wake.notify_one();
+    }
+
+    /**
+     * Drops the jobs still waiting in lane.
+     */
+    void clear(Lane lane) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued[lane].clear();
+    }
+
+    /**
+     * Drops the waiting jobs in lane and cancels the running ones.
+     */
+    void supersede(Lane lane) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued[lane].clear();
+        for (auto &cancelled: running[lane]) {
+            *cancelled = true;
+        }
+    }
+
+private:
+    struct Entry {
+        Job job;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+    };
+
+    bool next_lane(Lane &lane) const {
+        if (!queued[VIEWPORT].empty()) {
+            lane = VIEWPORT;
+            return true;
+        }
+        if (running[PYRAMID].size() + running[PREFETCH].size() + 1 >= thread_count) {
+            return false;
+        }
+        for (auto background: {PYRAMID, PREFETCH}) {
+            if (!queued[background].empty()) {
+                lane = background;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            Lane lane = VIEWPORT;
+            wake.wait(lock, [this, &lane] { return stopping || next_lane(lane); });
+            if (stopping) {
+                return;
+            }
+            auto entry = std::move(queued[lane].front());
+            queued[lane].pop_front();
+            running[lane].push_back(entry.cancelled);
+
+            lock.unlock();
+            entry.job(*entry.cancelled);
+            lock.lock();
+
+            auto &mine = running[lane];
+            mine.erase(std::find(mine.begin(), mine.end(), entry.cancelled));
+            // a background slot may have opened up
+            wake.notify_one();
+        }
+    }
+
+    /**
+     * threads.size() once they all run, the first ones start while it grows.
+     */
+    const unsigned thread_count;
+    std::vector<std::thread> threads;
+    std::deque<Entry> queued[LANES];
+    std::vector<std::shared_ptr<std::atomic<bool>>> running[LANES];
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable wake;
+};
+
+/**
+ * What to draw, captured on the GTK thread when the image is requested.
+ */
+struct DrawRequest {
+    unsigned long generation = 0;
+    std::string path;
+    Gdk::PixbufRotation rotation = Gdk::PIXBUF_ROTATE_NONE;
+    double zoom = 1.0;
+    bool fit_to_window = true;
+    int window_width = 0;
+    int window_height = 0;
+    std::function<void()> zoom_adjustment;
+};
+
+/**
+ * A decoded image and the size to show it at. Handed from the decoder to the
+ * GTK thread and never modified after that.
+ */
+struct DecodedImage {
+    unsigned long generation = 0;
+    std::string path;
+    Gdk::PixbufRotation rotation = Gdk::PIXBUF_ROTATE_NONE;
+    /**
+     * Unturned, drawn turned by rotation.
+     */
+    Glib::RefPtr<Gdk::Pixbuf> pixbuf;
+    int full_width = 0;
+    int full_height = 0;
+    /**
+     * Still loading, pixbuf is a snapshot already scaled for display.
+     * Followed by more images of the same generation.
+     */
+    bool partial = false;
+    /**
+     * Size on screen, after turning.
+     */
+    int width = 0;
+    int height = 0;
+    std::function<void()> zoom_adjustment;
+};
+
+/**
+ * Passes decoded images to the GTK thread. Only the newest generation posted
+ * is kept, older ones are dropped on arrival.
+ */
+struct ImageMailbox {
+    void post(std::shared_ptr<const DecodedImage> image) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (latest && latest->generation > image->generation) {
+                return;
+            }
+            latest = std::move(image);
+        }
+        dispatcher.emit();
+    }
+
+    std::shared_ptr<const DecodedImage> take() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::move(latest);
+    }
+
+    Glib::Dispatcher dispatcher;
+    std::shared_ptr<const DecodedImage> latest;
+    std::mutex mutex;
+};
+
 // forward for struct member
 void next_image();
 
 void show_image(bool update_label);
 
-std::string get_directory_from_file(const std::string &filename) {
-    auto file = Gio::File::create_for_path(filename);
-    auto directory = file->get_parent()->get_parse_name();
-    return directory;
-}
-
 
 struct AppState {
 
     bool add_file(const std::string &filename) {
-        auto file = Gio::File::create_for_path(filename);
-        auto name = file->get_basename();
-        auto dot = name.find_last_of('.');
-        if (dot == std::string::npos) {
-#ifdef DEBUG_EOM
-            std::cerr << "rejected " << filename << "\n";
-#endif
-            return false;
-        }
-        auto ext = name.substr(dot + 1);
-        std::transform(ext.begin(), ext.end(), ext.begin(), tolower);
-        if (std::count(ALLOWED_EXTENSIONS.begin(), ALLOWED_EXTENSIONS.end(), ext)) {
+        if (is_image_file(AT_FDCWD, filename)) {
             filelist.push_back(filename);
             return true;
         }
@@ -96,13 +794,21 @@ struct AppState {
     }
 
     /**
-     * Add files with add_file()
+     * Add files with add_file(), or let dir_scanner add them. Grows while
+     * being browsed.
      */
-    std::vector<std::string> filelist;
+    FileList filelist;
 
     std::string last_directory;
 
-    std::vector<Glib::RefPtr<Gdk::Pixbuf>> preloaded;
+    /**
+     * Images around image_index, see prefetch_neighbours()
+     */
+    PixbufCache preloaded{768ul << 20};
+    /**
+     * Number of images decoded ahead of and behind image_index
+     */
+    size_t preload_radius = 2;
 
     std::function<void()> zoomAdjustment;
 
@@ -115,19 +821,57 @@ struct AppState {
     double zoom = 1.0;
     double old_zoom = 1.0;
 
-    std::map<std::string, Gdk::PixbufRotation> rotations;
-    size_t image_index = -1;
-    Glib::Dispatcher drawScaledDispatcher;
-    Glib::Dispatcher drawDispatcher;
-    struct ImageDraw {
-        int width = 0;
-        int height = 0;
-    } image_draw_params;
     /**
-     * Unintrusive difference type alias
+     * Turns of the files in filelist, by index. Cleared with filelist.
      */
-    using st = decltype(filelist)::difference_type;
+    IdMap<Gdk::PixbufRotation> rotations;
+    /**
+     * Saved files keep their modification time, so sorting by date still
+     * works. Set EOM_KEEP_TIMES=1 in the environment to turn it on.
+     */
+    bool keep_file_times = false;
 
+    Gdk::PixbufRotation rotation_of(size_t file) const {
+        auto rotation = rotations.find(FileId(file));
+        return rotation ? *rotation : Gdk::PIXBUF_ROTATE_NONE;
+    }
+
+    /**
+     * Indices of the images closest to image_index, nearest first, next before previous.
+     */
+    std::vector<size_t> neighbours() const {
+        std::vector<size_t> indices{image_index};
+        auto ahead = image_index;
+        auto behind = image_index;
+        for (size_t distance = 1; distance <= preload_radius && distance < filelist.size(); distance++) {
+            ahead = filelist.next(ahead);
+            behind = filelist.previous(behind);
+            for (auto i: {ahead, behind}) {
+                if (filelist.removed(i) || std::find(indices.begin(), indices.end(), i) != indices.end()) {
+                    continue;
+                }
+                indices.push_back(i);
+            }
+        }
+        indices.erase(indices.begin());
+        return indices;
+    }
+
+    size_t image_index = -1;
+    ImageMailbox decoded;
+    PyramidMailbox pyramids;
+    /**
+     * Generation of the last DrawRequest, and of the image on screen.
+     */
+    unsigned long generation = 0;
+    unsigned long displayed_generation = 0;
+    bool displayed_partial = false;
+    /**
+     * The decoded source of the image on screen, kept so zooming and resizing
+     * only rescale it.
+     */
+    std::string resident_path;
+    PixbufCache::Image resident;
     [[nodiscard]]
     int slideshow_interval_millis() const {
         return static_cast<int>(slideshow_interval);
@@ -169,68 +913,63 @@ struct AppState {
         }
         auto slideshow = [this]() -> bool {
             next_image();
-            return image_index != filelist.size() - 1;
+            return filelist.next(image_index) != 0;
         };
         slideshow_connection = Glib::signal_timeout().connect(slideshow, slideshow_interval_millis());
     }
 
     void next() {
-        current_directory_index++;
-        image_index = (image_index + 1) % filelist.size();
-        if (current_directory_index >= current_directory_count) {
-            update_current_directory();
-            current_directory_index = 0;
-        }
+        go_to(live(filelist.next(image_index), true));
     }
 
     void previous() {
-        image_index = image_index ? image_index - 1 : filelist.size() - 1;
-
-        current_directory_index--;
-        if (current_directory_index < 0) {
-            update_current_directory();
-            current_directory_index = current_directory_count - 1;
-        }
-
+        go_to(live(filelist.previous(image_index), false));
+    }
 
+    /**
+     * Moves to the first image of the next directory, or of the list after
+     * the last one.
+     */
+    void next_directory() {
+        go_to(live(filelist.next_directory(image_index), true));
     }
 
-    void update_current_directory() {
-        update_current_directory(get_directory_from_file(filelist[image_index]));
+    /**
+     * Moves to the first image of the directory before the current one.
+     */
+    void previous_directory() {
+        go_to(live(filelist.previous_directory(image_index), true));
     }
 
-    void update_current_directory(const std::string &new_directory) {
-        current_directory = new_directory;
+    /**
+     * The first file from index on, going forward or back around the list,
+     * that was not removed. index itself if every file was.
+     */
+    size_t live(size_t index, bool forward) const {
+        auto size = filelist.size();
+        for (size_t step = 0; step < size && filelist.removed(index); step++) {
+            index = forward ? filelist.next(index) : filelist.previous(index);
+        }
+        return index;
+    }
 
-        auto same_directory = [this](const std::string &f) {
-            auto file = Gio::File::create_for_path(f);
-            return get_directory_from_file(file->get_path()) == this->current_directory;
-        };
-#ifdef DEBUG_EOM
-        std::cerr << new_directory << "\n";
-#endif
-        auto file_it = filelist.begin() + st(image_index);
-        auto r_file_it = std::make_reverse_iterator(file_it);
-        // no double-counts of itself. apparently make_reverse magically fixes that.
-        auto after = std::count_if(file_it, filelist.end(), same_directory);
-        auto before = std::count_if(r_file_it, filelist.rend(), same_directory);
+    void go_to(size_t index) {
+        auto moved_directory = filelist.directory_id(index) != filelist.directory_id(image_index);
+        image_index = index;
+        if (moved_directory) {
+            update_current_directory();
+        }
+    }
 
-        current_directory_count = after + before;
-#ifdef DEBUG_EOM
-        std::cerr << "before: " << before << "\n";
-        std::cerr << "after: " << after << "\n";
-#endif
-        auto cur = std::find(filelist.begin(), filelist.end(), current());
+    void update_current_directory() {
+        current_directory = filelist.directory(image_index);
 #ifdef DEBUG_EOM
-        std::cerr << "cur: " << *cur << "\n";
+        std::cerr << current_directory << "\n";
 #endif
-
     }
 
-    std::string get_directory_name() const {
-        auto file = Gio::File::create_for_path(current_directory);
-        auto directory_name = file->get_basename();
-        return directory_name;
+    std::string_view get_directory_name() const {
+        return base_name(current_directory);
     }
 
     std::string current() {
@@ -240,27 +979,30 @@ struct AppState {
     }
 
     std::string current_directory;
-    long current_directory_index = -1;
-    long current_directory_count = 0;
 
     std::string reset() {
         image_index = 0;
-        current_directory_index = 0;
         update_current_directory();
         return current();
     }
 
+    /**
+     * Position in the current directory, which may still be growing.
+     */
     std::string in_current_directory() const {
-        return get_directory_name() + " " + std::to_string(current_directory_index + 1) + "/" +
-               std::to_string(current_directory_count);
+        if (image_index >= filelist.size()) {
+            return "";
+        }
+        std::string text(get_directory_name());
+        return text + " " + std::to_string(filelist.directory_position(image_index) + 1) + "/" +
+               std::to_string(filelist.directory_files(image_index));
     }
 
-    std::string current_name() {
-        if (filelist.empty()) {
+    std::string_view current_name() const {
+        if (image_index >= filelist.size()) {
             return "";
         }
-        auto file = Gio::File::create_for_path(current());
-        return file->get_basename();
+        return filelist.name(image_index);
     }
 
     std::string percentage_done() const {
@@ -286,7 +1028,7 @@ struct AppState {
     }
 
     std::string label() {
-        auto text = current_name();
+        std::string text(current_name());
         text += zoom_text() + ", " + in_current_directory() + " " + percentage_done();
         return text;
     }
@@ -306,7 +1048,7 @@ struct AppState {
         auto adjust_value = v_adjust->get_value();
         auto zoom_change = (zoom - old_zoom);
 
-        auto child_height = app_widgets.pixbuf->get_height() * (1 + zoom_change);
+        auto child_height = app_widgets.image->get_height() * (1 + zoom_change);
         auto view_height = app_widgets.scrolled_window->get_height();
         auto c_v_ratio = double(child_height) / double(view_height);
         if (c_v_ratio <= 1.0) {
@@ -337,7 +1079,7 @@ struct AppState {
         auto h_adjust = app_widgets.scrolled_window->get_hadjustment();
         auto adjust_value = h_adjust->get_value();
         auto zoom_change = (zoom - old_zoom);
-        auto child_width = app_widgets.pixbuf->get_width() * (1 + zoom_change);
+        auto child_width = app_widgets.image->get_width() * (1 + zoom_change);
         auto view_width = app_widgets.scrolled_window->get_width();
         auto c_v_ratio = double(child_width) / double(view_width);
         if (c_v_ratio <= 1.0) {
@@ -352,7 +1094,7 @@ struct AppState {
     }
 
     void calculateZoomAdjustment() {
-        if (zoom == old_zoom) {
+        if (zoom == old_zoom || !app_widgets.pixbuf) {
             zoomAdjustment = nullptr;
             return;
         }
@@ -411,65 +1153,280 @@ void toggle_show_label() {
     app_state.label_showing = !app_state.label_showing;
 }
 
-std::atomic<bool> drawing = false;
+DecodePool decode_pool{std::max(2u, std::min(std::thread::hardware_concurrency(), 4u))};
 
+/**
+ * Builds the pyramid of source in the background, replacing any that is still
+ * being built.
+ */
+void request_pyramid(const Glib::RefPtr<Gdk::Pixbuf> &source) {
+    decode_pool.supersede(DecodePool::PYRAMID);
+    if (source->get_width() < 2 * PYRAMID_MIN_SIZE || source->get_height() < 2 * PYRAMID_MIN_SIZE) {
+        return;
+    }
+    decode_pool.submit(DecodePool::PYRAMID, [source](const std::atomic<bool> &cancelled) {
+        auto pyramid = build_pyramid(source, cancelled);
+        if (!cancelled) {
+            app_state.pyramids.post(std::move(pyramid));
+        }
+    });
+}
 
-void on_image_noscale_notify() {
-    app_widgets.image->set(app_widgets.pixbuf);
+void on_pyramid_notify() {
+    app_widgets.image->set_pyramid(app_state.pyramids.take());
+}
+
+void display(const DecodedImage &image) {
+    auto first_of_generation = image.generation > app_state.displayed_generation;
+    app_state.displayed_generation = image.generation;
+    app_state.displayed_partial = image.partial;
+    if (!image.partial && image.pixbuf != app_state.resident.pixbuf) {
+        request_pyramid(image.pixbuf);
+    }
+    if (!image.partial) {
+        app_widgets.pixbuf = image.pixbuf;
+        app_state.resident_path = image.path;
+        app_state.resident = {image.pixbuf, image.full_width, image.full_height};
+    }
+    app_widgets.image->set_image(image.pixbuf, image.width, image.height, image.rotation);
+    if (first_of_generation && image.zoom_adjustment) {
+        image.zoom_adjustment();
+    }
 }
 
 void on_image_notify() {
-    app_widgets.image->set(
-            app_widgets.pixbuf->scale_simple(app_state.image_draw_params.width, app_state.image_draw_params.height,
-                                             Gdk::INTERP_BILINEAR));
-    if (app_state.zoomAdjustment) {
-        app_state.zoomAdjustment();
-        app_state.zoomAdjustment = nullptr;
+    auto image = app_state.decoded.take();
+    if (!image || image->generation < app_state.displayed_generation) {
+        return;
+    }
+    if (image->generation == app_state.displayed_generation && !app_state.displayed_partial) {
+        return;
     }
+    display(*image);
 }
 
-void draw_current() {
-    auto noscale = true;
-    try {
-        app_widgets.pixbuf = Gdk::Pixbuf::create_from_file(app_state.current());
-
-        auto rotation = app_state.rotations[app_state.current()];
-        if (rotation != Gdk::PixbufRotation::PIXBUF_ROTATE_NONE) {
-            app_widgets.pixbuf = app_widgets.pixbuf->rotate_simple(rotation);
-        }
-        if (app_state.zoom != 1.0 && !app_state.fit_to_window) {
-            app_state.image_draw_params.width = int(app_state.zoom * app_widgets.pixbuf->get_width());
-            app_state.image_draw_params.height = int(app_state.zoom * app_widgets.pixbuf->get_height());
-            noscale = false;
-            app_state.fit_to_window = false;
-        }
-        if (app_state.fit_to_window) {
-            auto win_client = app_widgets.scrolled_window->get_clip();
-            auto win_ratio = win_client.get_width() * 1.0 / win_client.get_height();
-            auto img_ratio = app_widgets.pixbuf->get_width() * 1.0 / app_widgets.pixbuf->get_height();
-
-            if (win_ratio > img_ratio) { // win wider than image
-                app_state.image_draw_params.width = int(app_state.zoom * win_client.get_height() * img_ratio);
-                app_state.image_draw_params.height = int(app_state.zoom * win_client.get_height());
-                noscale = false;
-            } else {
-                app_state.image_draw_params.width = int(app_state.zoom * win_client.get_width());
-                app_state.image_draw_params.height = int(app_state.zoom * win_client.get_width() / img_ratio);
-                noscale = false;
+/**
+ * Sets the size on screen of an image_width x image_height image turned by
+ * request.rotation.
+ */
+void set_draw_size(const DrawRequest &request, int image_width, int image_height, DecodedImage &image) {
+    if (is_quarter_turn(request.rotation)) {
+        std::swap(image_width, image_height);
+    }
+    image.width = image_width;
+    image.height = image_height;
+    if (request.zoom != 1.0 && !request.fit_to_window) {
+        image.width = int(request.zoom * image_width);
+        image.height = int(request.zoom * image_height);
+    }
+    if (request.fit_to_window) {
+        auto win_ratio = request.window_width * 1.0 / request.window_height;
+        auto img_ratio = image_width * 1.0 / image_height;
+
+        if (win_ratio > img_ratio) { // win wider than image
+            image.width = int(request.zoom * request.window_height * img_ratio);
+            image.height = int(request.zoom * request.window_height);
+        } else {
+            image.width = int(request.zoom * request.window_width);
+            image.height = int(request.zoom * request.window_width / img_ratio);
+        }
+    }
+}
+
+/**
+ * The size a full_width x full_height image has to be decoded at for request, unturned.
+ */
+void needed_size(const DrawRequest &request, int full_width, int full_height, int &width, int &height) {
+    DecodedImage size;
+    set_draw_size(request, full_width, full_height, size);
+    auto quarter_turn = is_quarter_turn(request.rotation);
+    width = quarter_turn ? size.height : size.width;
+    height = quarter_turn ? size.width : size.height;
+}
+
+/**
+ * Snapshot of a loader's pixbuf, scaled for display so the loader can keep
+ * writing to its own buffer.
+ *
+ * @param full only the full size is used
+ */
+std::shared_ptr<const DecodedImage> partial_image(const DrawRequest &request, const PixbufCache::Image &full,
+                                                  const Glib::RefPtr<Gdk::Pixbuf> &partial) {
+    auto image = std::make_shared<DecodedImage>();
+    image->generation = request.generation;
+    image->path = request.path;
+    image->rotation = request.rotation;
+    image->partial = true;
+    image->zoom_adjustment = request.zoom_adjustment;
+
+    set_draw_size(request, full.full_width, full.full_height, *image);
+    if (image->width < 1 || image->height < 1) {
+        return nullptr;
+    }
+    auto quarter_turn = is_quarter_turn(request.rotation);
+    auto width = quarter_turn ? image->height : image->width;
+    auto height = quarter_turn ? image->width : image->height;
+    if (width == partial->get_width() && height == partial->get_height()) {
+        image->pixbuf = partial->copy();
+    } else {
+        image->pixbuf = partial->scale_simple(width, height, Gdk::INTERP_BILINEAR);
+    }
+    return image;
+}
+
+/**
+ * Decodes request.path no larger than the request needs, so fitting a large
+ * image to the window never materialises it at full size. Anything beyond
+ * the fitted size decodes the full image, so later zoom and pan steps are
+ * served from it and only rescaled.
+ *
+ * @param on_partial gets display ready snapshots while loading, may be empty
+ * @return the unturned image, its pixbuf is empty if cancelled
+ */
+PixbufCache::Image decode_image(const DrawRequest &request, const std::atomic<bool> &cancelled,
+                                const std::function<void(std::shared_ptr<const DecodedImage>)> &on_partial) {
+    PixbufCache::Image image;
+    auto decode_size = [&request, &image](int width, int height, int &decode_width, int &decode_height) {
+        image.full_width = width;
+        image.full_height = height;
+        if (!request.fit_to_window || request.zoom > 1.0) {
+            return;
+        }
+        needed_size(request, width, height, decode_width, decode_height);
+    };
+    std::function<void(const Glib::RefPtr<Gdk::Pixbuf> &)> show_partial;
+    if (on_partial) {
+        show_partial = [&request, &cancelled, &image, &on_partial](const Glib::RefPtr<Gdk::Pixbuf> &partial) {
+            if (cancelled || !image.full_width) {
+                return;
             }
-        } else { // no scale
+            if (auto snapshot = partial_image(request, image, partial)) {
+                on_partial(std::move(snapshot));
+            }
+        };
+    }
+
+    image.pixbuf = decode_progressive(request.path, cancelled, decode_size, show_partial);
+    if (!image.pixbuf) {
+        return {};
+    }
+    if (!image.full_width) {
+        image.full_width = image.pixbuf->get_width();
+        image.full_height = image.pixbuf->get_height();
+    }
+    return image;
+}
 
+/**
+ * @return the cached image if it is decoded large enough for request, otherwise an empty image.
+ */
+PixbufCache::Image cached_image(const DrawRequest &request) {
+    auto cached = app_state.preloaded.get(request.path);
+    if (!cached.pixbuf) {
+        return {};
+    }
+    int width;
+    int height;
+    needed_size(request, cached.full_width, cached.full_height, width, height);
+    return cached.covers(width, height) ? cached : PixbufCache::Image{};
+}
+
+/**
+ * Runs on a decoder thread, touches no shared state except the cache and
+ * the mailbox.
+ */
+void draw_current(const DrawRequest &request, const std::atomic<bool> &cancelled) {
+    auto image = std::make_shared<DecodedImage>();
+    image->generation = request.generation;
+    image->path = request.path;
+    image->rotation = request.rotation;
+    image->zoom_adjustment = request.zoom_adjustment;
+    try {
+        auto source = cached_image(request);
+        if (!source.pixbuf) {
+            auto post = [](std::shared_ptr<const DecodedImage> snapshot) {
+                app_state.decoded.post(std::move(snapshot));
+            };
+            source = decode_image(request, cancelled, post);
+            if (!source.pixbuf) {
+                return;
+            }
+            app_state.preloaded.put(request.path, source);
         }
+        image->pixbuf = source.pixbuf;
+        image->full_width = source.full_width;
+        image->full_height = source.full_height;
+        set_draw_size(request, source.full_width, source.full_height, *image);
     } catch (Glib::Error &error) {
         std::cerr << error.what() << "\n";
+        return;
+    }
+
+    if (cancelled) {
+        return;
+    }
+    app_state.decoded.post(std::move(image));
+}
+
+/**
+ * Decodes the neighbours of the current image into app_state.preloaded, at
+ * the size view needs. Neighbours of a previous image that are still waiting
+ * are dropped.
+ */
+void prefetch_neighbours(const DrawRequest &view) {
+    decode_pool.clear(DecodePool::PREFETCH);
+    for (auto i: app_state.neighbours()) {
+        auto request = view;
+        request.path = app_state.filelist[i];
+        request.rotation = app_state.rotation_of(i);
+        request.zoom_adjustment = nullptr;
+        decode_pool.submit(DecodePool::PREFETCH, [request](const std::atomic<bool> &cancelled) {
+            if (cancelled || cached_image(request).pixbuf) {
+                return;
+            }
+            try {
+                auto image = decode_image(request, cancelled, nullptr);
+                if (image.pixbuf) {
+                    app_state.preloaded.put(request.path, image);
+                }
+            } catch (Glib::Error &error) {
+#ifdef DEBUG_EOM
+                std::cerr << "prefetch " << request.path << ": " << error.what() << "\n";
+#endif
+            }
+        });
     }
+}
 
-    if (noscale) {
-        app_state.drawDispatcher.emit();
-    } else {
-        app_state.drawScaledDispatcher.emit();
+/**
+ * Shows request straight from the resident source when it is the same image
+ * decoded large enough, no decoder involved. Turning an image only lands
+ * here.
+ *
+ * @return false if the image has to be decoded
+ */
+bool show_resident(const DrawRequest &request) {
+    auto &resident = app_state.resident;
+    if (!resident.pixbuf || app_state.resident_path != request.path) {
+        return false;
     }
-    drawing = false;
+    int width;
+    int height;
+    needed_size(request, resident.full_width, resident.full_height, width, height);
+    if (!resident.covers(width, height)) {
+        return false;
+    }
+    DecodedImage image;
+    image.generation = request.generation;
+    image.path = request.path;
+    image.rotation = request.rotation;
+    image.pixbuf = resident.pixbuf;
+    image.full_width = resident.full_width;
+    image.full_height = resident.full_height;
+    image.zoom_adjustment = request.zoom_adjustment;
+    set_draw_size(request, resident.full_width, resident.full_height, image);
+    display(image);
+    return true;
 }
 
 void show_image(bool update_label = false) {
@@ -478,13 +1435,28 @@ void show_image(bool update_label = false) {
     }
     if (update_label)
         app_widgets.overlay_label->set_text(app_state.label());
-    if (drawing) {
+
+    DrawRequest request;
+    request.generation = ++app_state.generation;
+    request.path = app_state.current();
+    request.rotation = app_state.rotation_of(app_state.image_index);
+    request.zoom = app_state.zoom;
+    request.fit_to_window = app_state.fit_to_window;
+    auto win_client = app_widgets.scrolled_window->get_clip();
+    request.window_width = win_client.get_width();
+    request.window_height = win_client.get_height();
+    request.zoom_adjustment = std::move(app_state.zoomAdjustment);
+    app_state.zoomAdjustment = nullptr;
+
+    decode_pool.supersede(DecodePool::VIEWPORT);
+    if (show_resident(request)) {
+        prefetch_neighbours(request);
         return;
     }
-
-    drawing = true;
-    std::thread drawer(draw_current);
-    drawer.detach();
+    decode_pool.submit(DecodePool::VIEWPORT, [request](const std::atomic<bool> &cancelled) {
+        draw_current(request, cancelled);
+    });
+    prefetch_neighbours(request);
 }
 
 template<typename Func>
@@ -498,48 +1470,350 @@ void dont_save_rotated_files() {
     app_widgets.save_unsaved_dialog->hide();
 }
 
-void set_changed_text_label(long changed) {
-    std::string text = "There are ";
-    text += std::to_string(changed) + " unsaved images with changes. Do you want to save the changes?";
+void set_changed_text_label(long changed, bool saving = false) {
+    std::string text;
+    if (saving) {
+        text = "Saving, " + std::to_string(changed) + " images left.";
+    } else {
+        text = "There are " + std::to_string(changed) +
+               " unsaved images with changes. Do you want to save the changes?";
+    }
     app_widgets.unsaved_text_label->set_text(text);
     app_widgets.save_unsaved_dialog->queue_draw();
 }
 
-void save_rotated_files() {
-    using pair = decltype(*app_state.rotations.begin());
-    auto rotation_not_none = [](pair p) {
-        return p.second != Gdk::PIXBUF_ROTATE_NONE;
+/**
+ * How to re-encode a gdk-pixbuf format, see gdk_pixbuf_save().
+ */
+struct EncoderOptions {
+    std::vector<Glib::ustring> keys;
+    std::vector<Glib::ustring> values;
+    /**
+     * The saver takes the colour profile of the source.
+     */
+    bool icc_profile = false;
+};
+
+const std::map<std::string, EncoderOptions> ENCODER_OPTIONS = {
+        {"jpeg", {{"quality"}, {"95"}, true}},
+        {"png", {{"compression"}, {"6"}, true}},
+        // LZW
+        {"tiff", {{"compression"}, {"5"}, true}},
+        {"webp", {{"quality"}, {"95"}, false}},
+};
+
+/**
+ * What to do with a JPEG whose turn moves a partial block to the top or
+ * left, where it can't go without loss.
+ */
+enum class PartialBlocks {
+    /**
+     * Leave the file as it is and let the user choose.
+     */
+    ASK,
+    /**
+     * Cut the partial blocks off, up to 15 pixels, and turn the rest losslessly.
+     */
+    TRIM,
+    /**
+     * Decode and encode it again.
+     */
+    ENCODE,
+};
+
+/**
+ * Writes path back turned by rotation, in the format it is in. JPEGs are
+ * turned losslessly, other formats are decoded and encoded again. path is
+ * only replaced once the new file is complete on disk.
+ *
+ * @return false, with path untouched, for a JPEG with partial blocks when
+ * partial is ASK
+ */
+bool save_rotated(const std::string &path, Gdk::PixbufRotation rotation, bool keep_times, PartialBlocks partial) {
+    int width;
+    int height;
+    auto format = Gdk::Pixbuf::get_file_info(path, width, height);
+    if (!format.gobj()) {
+        throw Gdk::PixbufError(Gdk::PixbufError::UNKNOWN_TYPE, "Unknown image format: " + path);
+    }
+    auto name = format.get_name();
+
+    AtomicFile file(path, keep_times);
+    if (name == "jpeg" && partial != PartialBlocks::ENCODE) {
+        if (rotate_jpeg(path, file.temp_path(), Rotation(int(rotation)), partial == PartialBlocks::TRIM)) {
+            file.commit();
+            return true;
+        }
+        if (partial == PartialBlocks::ASK) {
+            return false;
+        }
+        // smaller than one block, nothing is left to trim to
+    }
+    if (!format.is_writable()) {
+        throw Gdk::PixbufError(Gdk::PixbufError::UNSUPPORTED_OPERATION, "Can't save " + name + " images: " + path);
+    }
+    auto source = Gdk::Pixbuf::create_from_file(path);
+    EncoderOptions options;
+    auto it = ENCODER_OPTIONS.find(name);
+    if (it != ENCODER_OPTIONS.end()) {
+        options = it->second;
+    }
+    auto profile = source->get_option("icc-profile");
+    if (options.icc_profile && !profile.empty()) {
+        options.keys.emplace_back("icc-profile");
+        options.values.push_back(profile);
+    }
+    rotated(source, rotation)->save(file.temp_path(), name, options.keys, options.values);
+    file.commit();
+    return true;
+}
+
+/**
+ * Saves rotated files on threads of its own so the GTK thread stays free.
+ * Each finished file is posted back through the dispatcher.
+ */
+struct SaveEngine {
+    /**
+     * More threads than this only queue up on the disk.
+     */
+    static constexpr unsigned MAX_THREADS = 8;
+
+    struct Job {
+        FileId file;
+        std::string path;
+        Gdk::PixbufRotation rotation;
+        PartialBlocks partial = PartialBlocks::ASK;
+    };
+
+    struct Result {
+        Job job;
+        /**
+         * Empty if saved.
+         */
+        std::string error;
+        /**
+         * Not saved, the user chooses how to turn it, see PartialBlocks.
+         */
+        bool partial = false;
     };
-    auto rotated = count_if(app_state.rotations.begin(), app_state.rotations.end(), rotation_not_none);
 
-    for (auto p: app_state.rotations) {
-        if (rotation_not_none(p)) {
-            auto pixbuf = Gdk::Pixbuf::create_from_file(p.first);
-            pixbuf = pixbuf->rotate_simple(p.second);
-            pixbuf->save(p.first, "jpeg");
-            rotated--;
-            app_state.rotations[p.first] = Gdk::PIXBUF_ROTATE_NONE;
-            set_changed_text_label(rotated);
+    ~SaveEngine() {
+        finish();
+    }
+
+    void start(std::vector<Job> batch) {
+        jobs = std::move(batch);
+        next = 0;
+        remaining = jobs.size();
+        auto thread_count = std::min({std::max(1u, std::thread::hardware_concurrency()), MAX_THREADS,
+                                      unsigned(jobs.size())});
+        for (unsigned i = 0; i < thread_count; i++) {
+            threads.emplace_back(&SaveEngine::work, this);
+        }
+    }
+
+    [[nodiscard]]
+    bool busy() const {
+        return !threads.empty();
+    }
+
+    std::vector<Result> take() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::move(results);
+    }
+
+    /**
+     * Waits for the threads, call once remaining is 0.
+     */
+    void finish() {
+        for (auto &thread: threads) {
+            thread.join();
+        }
+        threads.clear();
+        jobs.clear();
+    }
+
+    void work() {
+        for (auto i = next++; i < jobs.size(); i = next++) {
+            Result result{jobs[i], {}};
+            try {
+                result.partial = !save_rotated(result.job.path, result.job.rotation, keep_times, result.job.partial);
+            } catch (Glib::Error &error) {
+                result.error = error.what();
+            } catch (std::runtime_error &error) {
+                result.error = error.what();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                results.push_back(std::move(result));
+            }
+            dispatcher.emit();
         }
     }
 
+    Glib::Dispatcher dispatcher;
+    std::vector<Job> jobs;
+    bool keep_times = false;
+    std::atomic<size_t> next{0};
+    /**
+     * Jobs not yet taken as results, GTK thread only.
+     */
+    size_t remaining = 0;
+    std::vector<std::thread> threads;
+    std::vector<Result> results;
+    std::mutex mutex;
+    /**
+     * JPEGs of this batch left for the user, GTK thread only.
+     */
+    std::vector<Job> partial;
+    /**
+     * Runs on the GTK thread after the last file is saved.
+     */
+    std::function<void()> on_done;
+} save_engine;
+
+long count_unsaved() {
+    long unsaved = 0;
+    app_state.rotations.for_each([&unsaved](FileId file, Gdk::PixbufRotation rotation) {
+        unsaved += rotation != Gdk::PIXBUF_ROTATE_NONE && !app_state.filelist.removed(file);
+    });
+    return unsaved;
+}
+
+/**
+ * Starts saving every rotated file in the background. The dialog stays up
+ * counting down until on_done runs. Rotations made meanwhile are kept.
+ */
+void save_rotated_files(std::function<void()> on_done) {
+    std::vector<SaveEngine::Job> jobs;
+    app_state.rotations.for_each([&jobs](FileId file, Gdk::PixbufRotation rotation) {
+        // a removed file is gone or renamed, its new name has the turn then
+        if (rotation != Gdk::PIXBUF_ROTATE_NONE && !app_state.filelist.removed(file)) {
+            jobs.push_back({file, app_state.filelist[file], rotation});
+        }
+    });
+    save_engine.on_done = std::move(on_done);
+    save_engine.keep_times = app_state.keep_file_times;
+    app_widgets.save_unsaved_dialog->set_response_sensitive(Gtk::RESPONSE_YES, false);
+    app_widgets.save_unsaved_dialog->set_response_sensitive(Gtk::RESPONSE_NO, false);
+    app_widgets.save_unsaved_dialog->show();
+    set_changed_text_label(long(jobs.size()), true);
+    save_engine.start(std::move(jobs));
 }
 
-void check_save_on_exit() {
-    using pair = decltype(*app_state.rotations.begin());
-    auto rotation_not_none = [](pair p) {
-        return p.second != Gdk::PIXBUF_ROTATE_NONE;
-    };
-    auto rotated = count_if(app_state.rotations.begin(), app_state.rotations.end(), rotation_not_none);
+/**
+ * Asks how to save count JPEGs that can't be turned losslessly as they are.
+ *
+ * @return ASK if they stay unsaved
+ */
+PartialBlocks ask_partial_blocks(size_t count) {
+    Gtk::MessageDialog dialog(*app_widgets.save_unsaved_dialog,
+                              std::to_string(count) + " JPEG images can't be turned without loss as they are.",
+                              false, Gtk::MESSAGE_QUESTION, Gtk::BUTTONS_NONE, true);
+    dialog.set_secondary_text("Their size is not a whole number of 8 or 16 pixel blocks. Up to 15 pixels can be "
+                              "cut off an edge so the rest turns losslessly, or they can be encoded again, which "
+                              "loses a little quality and the metadata.");
+    dialog.add_button("_Keep unsaved", Gtk::RESPONSE_CANCEL);
+    dialog.add_button("_Encode again", Gtk::RESPONSE_NO);
+    dialog.add_button("_Cut the edges", Gtk::RESPONSE_YES);
+    switch (dialog.run()) {
+        case Gtk::RESPONSE_YES:
+            return PartialBlocks::TRIM;
+        case Gtk::RESPONSE_NO:
+            return PartialBlocks::ENCODE;
+        default:
+            return PartialBlocks::ASK;
+    }
+}
+
+void on_saved() {
+    auto current_saved = false;
+    for (auto &result: save_engine.take()) {
+        save_engine.remaining--;
+        auto &path = result.job.path;
+        if (!result.error.empty()) {
+            std::cerr << result.error << "\n";
+            continue;
+        }
+        if (result.partial) {
+            save_engine.partial.push_back(std::move(result.job));
+            continue;
+        }
+        app_state.preloaded.forget(path);
+        if (app_state.resident_path == path) {
+            app_state.resident = {};
+        }
+        // the file now has the saved turn, keep whatever was turned since
+        auto &rotation = app_state.rotations[result.job.file];
+        rotation = Gdk::PixbufRotation((int(rotation) - int(result.job.rotation) + 360) % 360);
+        current_saved = current_saved || result.job.file == app_state.image_index;
+    }
+    set_changed_text_label(long(save_engine.remaining), true);
+    if (current_saved) {
+        show_image();
+    }
+    if (save_engine.remaining || !save_engine.busy()) {
+        return;
+    }
+    save_engine.finish();
+    if (!save_engine.partial.empty()) {
+        auto jobs = std::move(save_engine.partial);
+        save_engine.partial.clear();
+        auto partial = ask_partial_blocks(jobs.size());
+        if (partial != PartialBlocks::ASK) {
+            for (auto &job: jobs) {
+                job.partial = partial;
+            }
+            set_changed_text_label(long(jobs.size()), true);
+            save_engine.start(std::move(jobs));
+            return;
+        }
+    }
+    app_widgets.save_unsaved_dialog->set_response_sensitive(Gtk::RESPONSE_YES, true);
+    app_widgets.save_unsaved_dialog->set_response_sensitive(Gtk::RESPONSE_NO, true);
+    app_widgets.save_unsaved_dialog->hide();
+    auto on_done = std::move(save_engine.on_done);
+    save_engine.on_done = nullptr;
+    if (on_done) {
+        on_done();
+    }
+}
+
+/**
+ * Asks to save rotated files, then runs then once they are saved or
+ * declined. A save already running runs then after what was waiting on it.
+ */
+void check_save_on_exit(std::function<void()> then) {
+    if (save_engine.busy()) {
+        if (then) {
+            auto waiting = std::move(save_engine.on_done);
+            save_engine.on_done = [waiting, then]() {
+                if (waiting) {
+                    waiting();
+                }
+                then();
+            };
+        }
+        return;
+    }
+    auto rotated = count_unsaved();
 
     if (rotated) {
         set_changed_text_label(rotated);
         //app_widgets.save_unsaved_dialog->show();
         if (app_widgets.save_unsaved_dialog->run() == Gtk::RESPONSE_YES) {
-            save_rotated_files();
+            save_rotated_files(std::move(then));
+            return;
         }
         app_widgets.save_unsaved_dialog->hide();
     }
+    if (then) {
+        then();
+    }
+}
+
+void check_save() {
+    check_save_on_exit(nullptr);
 }
 
 /**
@@ -550,8 +1824,9 @@ void leave_fullscreen_or_leave_app() {
         app_widgets.main_window->unfullscreen();
         app_state.fullscreen = false;
     } else {
-        check_save_on_exit();
-        app_widgets.main_window->close();
+        check_save_on_exit([]() {
+            app_widgets.main_window->close();
+        });
     }
 }
 
@@ -594,7 +1869,7 @@ void prev_image() {
 }
 
 void rotate_left() {
-    auto &rotation = app_state.rotations[app_state.current()];
+    auto &rotation = app_state.rotations[FileId(app_state.image_index)];
     switch (rotation) {
         case Gdk::PixbufRotation::PIXBUF_ROTATE_NONE:
             rotation = Gdk::PixbufRotation::PIXBUF_ROTATE_COUNTERCLOCKWISE;
@@ -613,7 +1888,7 @@ void rotate_left() {
 }
 
 void rotate_right() {
-    auto &rotation = app_state.rotations[app_state.current()];
+    auto &rotation = app_state.rotations[FileId(app_state.image_index)];
 
     switch (rotation) {
         case Gdk::PixbufRotation::PIXBUF_ROTATE_NONE:
@@ -632,42 +1907,16 @@ void rotate_right() {
 }
 
 void next_directory() {
-    auto ctx = app_state.current_directory;
-    do {
-        app_state.next();
-        if (app_state.image_index == 0) {
-            break;
-        }
-        auto cur = app_state.filelist[app_state.image_index];
-        ctx = get_directory_from_file(cur);
-
-    } while (app_state.current_directory == ctx);
+    if (app_state.filelist.empty())
+        return;
+    app_state.next_directory();
     show_image(true);
 }
 
 void prev_directory() {
-    auto ctx = app_state.current_directory;
-    while (ctx == app_state.current_directory) {
-        if (app_state.image_index == 0) {
-            app_state.image_index = app_state.filelist.size();
-        }
-        app_state.image_index--;
-
-        auto cur = app_state.filelist[app_state.image_index];
-        ctx = get_directory_from_file(cur);
-    }
-
-    bool underflow = false;
-    while (ctx == app_state.current_directory) {
-        if (app_state.image_index == 0) {
-            underflow = true;
-            break;
-        }
-        app_state.image_index--;
-    }
-    if (!underflow)
-        app_state.image_index++;
-
+    if (app_state.filelist.empty())
+        return;
+    app_state.previous_directory();
     show_image(true);
 }
 
@@ -675,6 +1924,21 @@ void toggle_slideshow() {
     app_state.toggle_slideshow();
 }
 
+/**
+ * The local path of what chooser selected, empty if there is none. Remote
+ * files only have one when gvfs mounts them, Gio looks that up.
+ */
+std::string chosen_path(Gtk::FileChooser &chooser) {
+    auto path = chooser.get_filename();
+    if (path.empty()) {
+        auto file = chooser.get_file();
+        if (file) {
+            path = file->get_path();
+        }
+    }
+    return path;
+}
+
 void show_open_dialog() {
     Gtk::FileChooserDialog fcd(*app_widgets.main_window, "Select folder",
                                Gtk::FileChooserAction::FILE_CHOOSER_ACTION_OPEN,
@@ -685,32 +1949,347 @@ void show_open_dialog() {
     auto res = fcd.run();
     if (res == Gtk::RESPONSE_OK) {
         app_state.image_index = 0;
-        auto filename = fcd.get_filename();
-        if (app_state.add_file(filename)) {
+        auto filename = chosen_path(fcd);
+        if (!filename.empty() && app_state.add_file(filename)) {
+            app_state.update_current_directory();
             show_image(true);
         }
     }
 }
 
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "misc-no-recursion"
+/**
+ * Tells the GTK thread that dir_scanner added to the file list. Notifications
+ * are merged while the GTK thread is busy.
+ */
+struct ScanNotifier {
+    void notify() {
+        if (!pending.exchange(true)) {
+            dispatcher.emit();
+        }
+    }
+
+    void notify_done() {
+        done = true;
+        pending = true;
+        dispatcher.emit();
+    }
+
+    /**
+     * Forgets what a cancelled scan posted, an emission still queued then
+     * finds nothing done.
+     */
+    void reset() {
+        pending = false;
+        done = false;
+    }
+
+    /**
+     * @param finished set if the scan is done
+     */
+    void take(bool &finished) {
+        pending = false;
+        finished = done.exchange(false);
+    }
+
+    Glib::Dispatcher dispatcher;
+    std::atomic<bool> pending{false};
+    std::atomic<bool> done{false};
+} scanned;
+
+/**
+ * Hands the changes dir_watcher saw to the GTK thread, which applies them
+ * since the file list takes removals from one thread only.
+ */
+struct WatchNotifier {
+    void post(DirWatcher::Change change) {
+        bool first;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            first = changes.empty();
+            changes.push_back(std::move(change));
+        }
+        if (first) {
+            dispatcher.emit();
+        }
+    }
+
+    std::vector<DirWatcher::Change> take() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::move(changes);
+    }
+
+    /**
+     * What a rescan found in a directory. Files listed before it was read
+     * and not found are gone, files added since are kept.
+     */
+    struct Listing {
+        size_t known = 0;
+        std::unordered_set<std::string> names;
+    };
+
+    /**
+     * Drops what was posted for an earlier tree and follows root.
+     */
+    void reset(const std::string &directory) {
+        std::lock_guard<std::mutex> lock(mutex);
+        changes.clear();
+        listings.clear();
+        listed = false;
+        root = directory;
+    }
+
+    /**
+     * Called by a rescan before directory is read, on the scanning threads.
+     */
+    void visit(const std::string &directory, size_t known) {
+        std::lock_guard<std::mutex> lock(mutex);
+        listings[directory].known = known;
+    }
 
-void add_files_in_dir(const std::string &pathname) {
-    auto dir = Gio::File::create_for_path(pathname);
-    auto files = dir->enumerate_children();
+    void post_listing(const DirScanner::Batch &batch) {
+        std::lock_guard<std::mutex> lock(mutex);
+        listings[batch.directory].names.insert(batch.names.begin(), batch.names.end());
+    }
 
-    for (auto file = files->next_file(); file; file = files->next_file()) {
-        if (file->get_file_type() == Gio::FileType::FILE_TYPE_REGULAR) {
-            app_state.add_file(pathname + "/" + file->get_name());
+    void post_listed() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            listed = true;
         }
-        if (file->get_file_type() == Gio::FileType::FILE_TYPE_DIRECTORY) {
-            add_files_in_dir(pathname + "/" + file->get_name());
+        dispatcher.emit();
+    }
+
+    /**
+     * @param complete set if a rescan finished, the listings are returned then
+     */
+    std::unordered_map<std::string, Listing> take_listings(bool &complete) {
+        std::lock_guard<std::mutex> lock(mutex);
+        complete = listed;
+        if (!listed) {
+            return {};
         }
+        listed = false;
+        auto taken = std::move(listings);
+        listings.clear();
+        return taken;
+    }
+
+    /**
+     * A file renamed away, until its new name shows up.
+     */
+    struct Moved {
+        Gdk::PixbufRotation rotation;
+        bool current;
+    };
+
+    Glib::Dispatcher dispatcher;
+    std::vector<DirWatcher::Change> changes;
+    /**
+     * By directory, filled while a rescan runs.
+     */
+    std::unordered_map<std::string, Listing> listings;
+    bool listed = false;
+    std::mutex mutex;
+    /**
+     * The directory the watcher follows, GTK thread only.
+     */
+    std::string root;
+} watched;
+
+/**
+ * The scanning threads watch each directory they read, so this is declared
+ * before dir_scanner and destroyed after it has joined them. Its own thread
+ * posts to watched, declared before it.
+ */
+DirWatcher dir_watcher;
+
+/**
+ * Reading directories mostly waits on the disk, or the network for shares,
+ * so there are more threads than cores.
+ */
+DirScanner dir_scanner{std::clamp(2 * std::thread::hardware_concurrency(), 4u, 16u)};
+
+/**
+ * Runs on the scanning threads. The directory is watched before it is read,
+ * so dir_watcher may have added some of the names already.
+ */
+void add_scanned(DirScanner::Batch batch) {
+    if (batch.names.empty()) {
+        return;
+    }
+    app_state.filelist.merge(batch.directory, batch.names);
+    scanned.notify();
+}
+
+/**
+ * Shows the first image the scanner found at once, after that only the
+ * label follows the growing list.
+ */
+void on_scan_notify() {
+    auto finished = false;
+    scanned.take(finished);
+    if (finished) {
+        dir_scanner.finish();
+#ifdef DEBUG_EOM
+        std::cerr << "Added " << app_state.filelist.size() << " images.\n";
+#endif
+    }
+    if (app_state.filelist.empty()) {
+        return;
+    }
+    if (app_state.image_index >= app_state.filelist.size()) {
+        app_state.reset();
+        show_image(true);
+    } else {
+        // a directory arrives whole, the current one is already counted
+        app_widgets.overlay_label->set_text(app_state.label());
     }
+}
 
+/**
+ * Drops decoded copies of path, it changed or is gone.
+ */
+void forget_image(const std::string &path) {
+    app_state.preloaded.forget(path);
+    if (app_state.resident_path == path) {
+        app_state.resident = {};
+    }
 }
 
-#pragma clang diagnostic pop
+/**
+ * Reads the watched tree again after inotify lost events. New files are
+ * merged in as their directories are read, the files that are gone are
+ * removed by remove_unlisted() once the scan is complete.
+ */
+void rescan_watched() {
+    dir_scanner.cancel();
+    scanned.reset();
+    watched.reset(watched.root);
+    auto visit = [](const std::string &directory) {
+        watched.visit(directory, app_state.filelist.size());
+        dir_watcher.watch(directory);
+    };
+    auto record = [](DirScanner::Batch batch) {
+        watched.post_listing(batch);
+        add_scanned(std::move(batch));
+    };
+    auto done = []() {
+        watched.post_listed();
+        scanned.notify_done();
+    };
+    dir_scanner.scan(watched.root, is_image_file, record, done, nullptr, visit);
+}
+
+/**
+ * Removes the files below the watched root that a complete rescan didn't
+ * find, directories it didn't reach included.
+ */
+void remove_unlisted(const std::unordered_map<std::string, WatchNotifier::Listing> &listings) {
+    auto &list = app_state.filelist;
+    if (list.empty()) {
+        return;
+    }
+    auto root = trim_slashes(watched.root);
+    size_t first = 0;
+    do {
+        auto directory = list.directory(first);
+        if (is_within(directory, root)) {
+            auto listing = listings.find(std::string(directory));
+            auto id = list.directory_id(first);
+            auto i = first;
+            do {
+                auto found = listing != listings.end() &&
+                             (i >= listing->second.known || listing->second.names.count(std::string(list.name(i))));
+                if (!found && !list.removed(i)) {
+                    list.remove(i);
+                    forget_image(list[i]);
+                }
+                i = list.next(i);
+            } while (i != first && list.directory_id(i) == id);
+        }
+        first = list.next_directory(first);
+    } while (first != 0);
+}
+
+/**
+ * Applies what changed on disk. Files keep their indices, so the image on
+ * screen stays unless it is removed, then the next one is shown. A renamed
+ * file keeps its turn and stays on screen under its new name, as long as
+ * both halves of the rename come in one batch.
+ */
+void on_watch_notify() {
+    auto &list = app_state.filelist;
+    auto shown = app_state.image_index;
+    auto redraw = false;
+    // by inotify cookie, a rename out of the watched tree never completes
+    std::unordered_map<uint32_t, WatchNotifier::Moved> moved;
+    auto rescan = false;
+    for (auto &change: watched.take()) {
+        switch (change.kind) {
+            case DirWatcher::Change::WRITTEN: {
+                auto i = list.find(change.directory, change.name);
+                if (i != list.size()) {
+                    forget_image(list[i]);
+                    redraw = redraw || i == app_state.image_index;
+                } else {
+                    list.append(change.directory, {change.name});
+                    i = list.find(change.directory, change.name);
+                }
+                auto from = moved.find(change.cookie);
+                if (change.cookie && from != moved.end()) {
+                    app_state.rotations[FileId(i)] = from->second.rotation;
+                    if (from->second.current) {
+                        shown = i;
+                    }
+                    moved.erase(from);
+                }
+                break;
+            }
+            case DirWatcher::Change::REMOVED: {
+                auto i = list.find(change.directory, change.name);
+                if (i == list.size()) {
+                    break;
+                }
+                if (change.cookie) {
+                    moved[change.cookie] = {app_state.rotation_of(i), i == app_state.image_index};
+                }
+                list.remove(i);
+                forget_image(list[i]);
+                break;
+            }
+            case DirWatcher::Change::DIRECTORY_REMOVED:
+                list.remove_tree(change.directory);
+                break;
+            case DirWatcher::Change::OVERFLOWED:
+                rescan = true;
+                break;
+        }
+    }
+    bool complete;
+    auto listings = watched.take_listings(complete);
+    if (complete) {
+        remove_unlisted(listings);
+    }
+    if (rescan) {
+        rescan_watched();
+    }
+    // nothing shown yet, on_scan_notify() starts when there is
+    if (app_state.image_index >= list.size()) {
+        return;
+    }
+    if (shown != app_state.image_index) {
+        app_state.go_to(shown);
+        redraw = true;
+    } else if (list.removed(app_state.image_index)) {
+        app_state.go_to(app_state.live(app_state.image_index, true));
+        redraw = true;
+    }
+    if (redraw) {
+        show_image(true);
+    } else {
+        app_widgets.overlay_label->set_text(app_state.label());
+    }
+}
 
 void show_select_directory() {
     Gtk::FileChooserDialog fcd(*app_widgets.main_window, "Select folder",
@@ -724,17 +2303,54 @@ void show_select_directory() {
     fcd.add_button(Gtk::Stock::OPEN, Gtk::RESPONSE_OK);
     auto res = fcd.run();
     if (res == Gtk::RESPONSE_OK) {
-        auto pathname = fcd.get_filename();
+        auto pathname = chosen_path(fcd);
+        if (pathname.empty()) {
+            return;
+        }
         app_state.last_directory = pathname;
 #ifdef DEBUG_EOM
-        std::cerr << "Added " << app_state.filelist.size() << " images.";
         std::cerr << pathname << "\n";
 #endif
-        app_state.filelist.clear();
-        add_files_in_dir(pathname);
-
-        app_state.reset();
-        show_image(true);
+        // turns are kept by index, save them before the list goes
+        check_save_on_exit([pathname]() {
+            dir_scanner.cancel();
+            scanned.reset();
+            dir_watcher.start(is_image_file, [](DirWatcher::Change change) {
+                watched.post(std::move(change));
+            });
+            // changes below the old directory
+            watched.reset(pathname);
+            app_state.filelist.clear();
+            app_state.rotations.clear();
+            app_state.image_index = -1;
+            // a filter reading contents changes its mind without the directory changing
+            std::shared_ptr<ScanIndex> index;
+            if (FILTER_MODE == FilterMode::EXTENSION) {
+                index = std::make_shared<ScanIndex>(pathname, ALLOWED_EXTENSIONS_HASH);
+            }
+            auto record = [index](DirScanner::Batch batch) {
+                if (index) {
+                    index->record(batch);
+                }
+                add_scanned(std::move(batch));
+            };
+            auto done = [index]() {
+                if (index) {
+                    index->save();
+                }
+                scanned.notify_done();
+            };
+            DirScanner::Known known;
+            if (index) {
+                known = [index](const std::string &directory, const timespec &modified, DirScanner::Batch &batch) {
+                    return index->find(directory, modified, batch);
+                };
+            }
+            auto watch = [](const std::string &directory) {
+                dir_watcher.watch(directory);
+            };
+            dir_scanner.scan(pathname, is_image_file, record, done, known, watch);
+        });
     }
 }
 
@@ -785,7 +2401,7 @@ void setup_actions_and_connections() {
     add_win_action_and_connection("prev-directory", prev_directory);
     add_win_action_and_connection("rotate-left", rotate_left);
     add_win_action_and_connection("rotate-right", rotate_right);
-    add_win_action_and_connection("save", check_save_on_exit);
+    add_win_action_and_connection("save", check_save);
     add_win_action_and_connection("hide", dont_save_rotated_files);
 
 }
@@ -816,19 +2432,26 @@ void update_adjustment(double x, double y) {
 int main(int argc, char **argv) {
     auto app = Gtk::Application::create(argc, argv, "se.miun.markje", Gio::ApplicationFlags::APPLICATION_FLAGS_NONE);
 
-    app_state.drawDispatcher.connect(&on_image_noscale_notify);
-    app_state.drawScaledDispatcher.connect(&on_image_notify);
+    app_state.decoded.dispatcher.connect(&on_image_notify);
+    app_state.pyramids.dispatcher.connect(&on_pyramid_notify);
+    save_engine.dispatcher.connect(&on_saved);
+    scanned.dispatcher.connect(&on_scan_notify);
+    watched.dispatcher.connect(&on_watch_notify);
     auto recent_manager = Gtk::RecentManager::get_default();
     auto wd = Glib::get_current_dir();
     recent_manager->add_item(wd);
 
     find_allowed_image_formats();
+    FILTER_MODE = filter_mode_from_environment();
+    app_state.keep_file_times = Glib::getenv("EOM_KEEP_TIMES") == "1";
+#ifdef DEBUG_EOM
+    std::cerr << "Resampling with the " << resample_kernels() << " kernels.\n";
+#endif
 
     app_widgets.builder = Gtk::Builder::create_from_resource("/ui/eom.glade");
     app_widgets.builder->set_application(app);
 
     app_widgets.builder->get_widget("main_window", app_widgets.main_window);
-    app_widgets.builder->get_widget("main_image", app_widgets.image);
     app_widgets.builder->get_widget("scrolled_window", app_widgets.scrolled_window);
     app_widgets.builder->get_widget("viewport", app_widgets.viewport);
     app_widgets.builder->get_widget("header_menu_button", app_widgets.headerButton);
@@ -839,6 +2462,11 @@ int main(int argc, char **argv) {
     app_widgets.builder->get_widget("save_dialog", app_widgets.save_unsaved_dialog);
     app_widgets.builder->get_widget("unsaved_text_label", app_widgets.unsaved_text_label);
 
+    // main_image in the glade file is a plain Gtk::Image, draw tiles instead
+    app_widgets.viewport->remove();
+    app_widgets.image = Gtk::manage(new ImageView());
+    app_widgets.viewport->add(*app_widgets.image);
+
     app_widgets.overlay_label->override_background_color(Gdk::RGBA("rgba(255,255,255,0.6)"));
     app_widgets.overlay_label->override_color(Gdk::RGBA("rgb(0,0,0)"));
     app_widgets.overlay_label->set_opacity(0.6);
@@ -0,0 +1,137 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   parallel.cpp
+ *
+ * The helpers are started once and shared by every caller, so drawing and
+ * the decode threads don't each start a thread per core for every band.
+ */
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+struct Job {
+    const std::function<void(int first, int last)> &work;
+    int count;
+    int range;
+    std::atomic<int> next{0};
+    /**
+     * Helpers working on it, guarded by Pool::mutex.
+     */
+    int running = 0;
+
+    void run() {
+        for (;;) {
+            auto first = next.fetch_add(range);
+            if (first >= count) {
+                return;
+            }
+            work(first, std::min(count, first + range));
+        }
+    }
+};
+
+/**
+ * One thread less than there are cores, the caller is the last one. Never
+ * destroyed, see pool().
+ */
+struct Pool {
+    Pool() {
+        auto helpers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+        for (unsigned i = 0; i < helpers; i++) {
+            std::thread(&Pool::help, this).detach();
+        }
+    }
+
+    void help() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [this] {
+                return !jobs.empty();
+            });
+            auto job = jobs.front();
+            job->running++;
+            lock.unlock();
+            job->run();
+            lock.lock();
+            // all its ranges are taken, the next helper looks at the next job
+            auto queued = std::find(jobs.begin(), jobs.end(), job);
+            if (queued != jobs.end()) {
+                jobs.erase(queued);
+            }
+            if (--job->running == 0) {
+                idle.notify_all();
+            }
+        }
+    }
+
+    /**
+     * Runs job on the calling thread and up to helpers more.
+     */
+    void run(Job &job, int helpers) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(&job);
+        }
+        for (int i = 0; i < helpers; i++) {
+            wake.notify_one();
+        }
+        job.run();
+        std::unique_lock<std::mutex> lock(mutex);
+        auto queued = std::find(jobs.begin(), jobs.end(), &job);
+        if (queued != jobs.end()) {
+            jobs.erase(queued);
+        }
+        idle.wait(lock, [&job] {
+            return job.running == 0;
+        });
+    }
+
+    std::deque<Job *> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+};
+
+/**
+ * Left alive at exit, other globals such as the decode threads may still
+ * call parallel_for() while they are destroyed.
+ */
+Pool &pool() {
+    static Pool &shared = *new Pool;
+    return shared;
+}
+
+}
+
+void parallel_for(int count, int grain, const std::function<void(int first, int last)> &work) {
+    if (count <= 0) {
+        return;
+    }
+    grain = std::max(1, grain);
+    auto ranges = (count + grain - 1) / grain;
+    auto threads = std::min(ranges, int(std::max(1u, std::thread::hardware_concurrency())));
+    if (threads == 1) {
+        work(0, count);
+        return;
+    }
+
+    // a few ranges per thread, so one slow band doesn't leave the others idle
+    auto range = std::max(grain, (count + threads * 4 - 1) / (threads * 4));
+    Job job{work, count, range};
+    pool().run(job, threads - 1);
+}
@@ -0,0 +1,28 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   parallel.h
+ */
+
+#ifndef EOM_PARALLEL_H
+#define EOM_PARALLEL_H
+
+#include <functional>
+
+/**
+ * Calls work(first, last) for consecutive ranges covering [0, count), spread
+ * over all cores by threads shared with every other caller, and returns when
+ * all are done. Ranges are at least grain
+ * long except the last, so a range of image rows is a horizontal band.
+ *
+ * The calling thread takes part, work must not throw.
+ */
+void parallel_for(int count, int grain, const std::function<void(int first, int last)> &work);
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   path_util.h
+ *
+ * Splits local paths without allocating, the way basename(1) does. Nothing
+ * is looked up on disk and names are kept as bytes.
+ */
+
+#ifndef EOM_PATH_UTIL_H
+#define EOM_PATH_UTIL_H
+
+#include <string_view>
+
+/**
+ * path without trailing slashes, but "/" stays.
+ */
+inline std::string_view trim_slashes(std::string_view path) {
+    while (path.size() > 1 && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+    return path;
+}
+
+/**
+ * "/a/b.jpg" gives "b.jpg", "/a/b/" gives "b" and "/" gives "/".
+ */
+inline std::string_view base_name(std::string_view path) {
+    path = trim_slashes(path);
+    auto slash = path.rfind('/');
+    if (slash == std::string_view::npos || path.size() == 1) {
+        return path;
+    }
+    return path.substr(slash + 1);
+}
+
+/**
+ * True for path itself and everything below directory.
+ */
+inline bool is_within(std::string_view path, std::string_view directory) {
+    return path.compare(0, directory.size(), directory) == 0 &&
+           (path.size() == directory.size() || path[directory.size()] == '/' || directory.back() == '/');
+}
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   resample.cpp
+ *
+ * Both filters are separable. A destination row first combines the source
+ * rows under it into one row, which is where nearly all the work is and what
+ * the vector kernels do, then walks the destination columns.
+ */
+
+#include "resample.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EOM_X86
+#include <immintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+/**
+ * out = (a * (256 - weight) + b * weight) / 256, rounded, weight is 1..255.
+ */
+using BlendRows = void (*)(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n, unsigned weight);
+/**
+ * sums[i] += row[i]
+ */
+using AccumulateRow = void (*)(const uint8_t *row, uint32_t *sums, size_t n);
+
+void blend_rows_scalar(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n, unsigned weight) {
+    auto inverse = 256 - weight;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = uint8_t((a[i] * inverse + b[i] * weight + 128) >> 8);
+    }
+}
+
+void accumulate_row_scalar(const uint8_t *row, uint32_t *sums, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        sums[i] += row[i];
+    }
+}
+
+#ifdef EOM_X86
+
+__attribute__((target("sse4.1")))
+void blend_rows_sse41(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n, unsigned weight) {
+    auto weight_a = _mm_set1_epi16(short(256 - weight));
+    auto weight_b = _mm_set1_epi16(short(weight));
+    auto round = _mm_set1_epi16(128);
+    auto zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        // at most 255 * 256 + 128, fits unsigned 16 bit
+        auto lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), weight_a),
+                                              _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), weight_b)), round);
+        auto hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), weight_a),
+                                              _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), weight_b)), round);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                         _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+    blend_rows_scalar(a + i, b + i, out + i, n - i, weight);
+}
+
+__attribute__((target("sse4.1")))
+void accumulate_row_sse41(const uint8_t *row, uint32_t *sums, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        auto v = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + i));
+        auto lo = reinterpret_cast<__m128i *>(sums + i);
+        auto hi = reinterpret_cast<__m128i *>(sums + i + 4);
+        _mm_storeu_si128(lo, _mm_add_epi32(_mm_loadu_si128(lo), _mm_cvtepu8_epi32(v)));
+        _mm_storeu_si128(hi, _mm_add_epi32(_mm_loadu_si128(hi), _mm_cvtepu8_epi32(_mm_srli_si128(v, 4))));
+    }
+    accumulate_row_scalar(row + i, sums + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void blend_rows_avx2(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n, unsigned weight) {
+    auto weight_a = _mm256_set1_epi16(short(256 - weight));
+    auto weight_b = _mm256_set1_epi16(short(weight));
+    auto round = _mm256_set1_epi16(128);
+    auto zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        // unpack and pack both work per 128 bit lane, so the byte order survives
+        auto lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), weight_a),
+                                                    _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero), weight_b)),
+                                   round);
+        auto hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), weight_a),
+                                                    _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero), weight_b)),
+                                   round);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                            _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)));
+    }
+    blend_rows_sse41(a + i, b + i, out + i, n - i, weight);
+}
+
+__attribute__((target("avx2")))
+void accumulate_row_avx2(const uint8_t *row, uint32_t *sums, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        auto lo = reinterpret_cast<__m256i *>(sums + i);
+        auto hi = reinterpret_cast<__m256i *>(sums + i + 8);
+        _mm256_storeu_si256(lo, _mm256_add_epi32(_mm256_loadu_si256(lo), _mm256_cvtepu8_epi32(v)));
+        _mm256_storeu_si256(hi, _mm256_add_epi32(_mm256_loadu_si256(hi),
+                                                 _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8))));
+    }
+    accumulate_row_sse41(row + i, sums + i, n - i);
+}
+
+#endif
+
+#ifdef __ARM_NEON
+
+void blend_rows_neon(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n, unsigned weight) {
+    auto weight_a = vdup_n_u8(uint8_t(256 - weight));
+    auto weight_b = vdup_n_u8(uint8_t(weight));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto va = vld1q_u8(a + i);
+        auto vb = vld1q_u8(b + i);
+        auto lo = vmlal_u8(vmull_u8(vget_low_u8(va), weight_a), vget_low_u8(vb), weight_b);
+        auto hi = vmlal_u8(vmull_u8(vget_high_u8(va), weight_a), vget_high_u8(vb), weight_b);
+        vst1q_u8(out + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+    blend_rows_scalar(a + i, b + i, out + i, n - i, weight);
+}
+
+void accumulate_row_neon(const uint8_t *row, uint32_t *sums, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        auto v = vmovl_u8(vld1_u8(row + i));
+        vst1q_u32(sums + i, vaddw_u16(vld1q_u32(sums + i), vget_low_u16(v)));
+        vst1q_u32(sums + i + 4, vaddw_u16(vld1q_u32(sums + i + 4), vget_high_u16(v)));
+    }
+    accumulate_row_scalar(row + i, sums + i, n - i);
+}
+
+#endif
+
+struct Kernels {
+    const char *name;
+    BlendRows blend_rows;
+    AccumulateRow accumulate_row;
+};
+
+Kernels select_kernels() {
+#ifdef EOM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {"avx2", blend_rows_avx2, accumulate_row_avx2};
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return {"sse4.1", blend_rows_sse41, accumulate_row_sse41};
+    }
+#endif
+#ifdef __ARM_NEON
+    return {"neon", blend_rows_neon, accumulate_row_neon};
+#else
+    return {"scalar", blend_rows_scalar, accumulate_row_scalar};
+#endif
+}
+
+const Kernels &kernels() {
+    static const Kernels selected = select_kernels();
+    return selected;
+}
+
+void blend_rows(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n, unsigned weight) {
+    if (weight == 0 || a == b) {
+        std::memcpy(out, a, n);
+    } else if (weight >= 256) {
+        std::memcpy(out, b, n);
+    } else {
+        kernels().blend_rows(a, b, out, n, weight);
+    }
+}
+
+/**
+ * Source position of the center of destination pixel i, clamped to the image.
+ */
+double sample_position(int i, int start, double scale, int size) {
+    return std::clamp((start + i + 0.5) / scale - 0.5, 0.0, double(size - 1));
+}
+
+unsigned fraction_weight(double position, int whole) {
+    return unsigned(std::lround((position - whole) * 256));
+}
+
+void resample_bilinear(const ImageBuffer &source, const ImageBuffer &dest, int left, int top,
+                       double scale_x, double scale_y) {
+    auto channels = size_t(dest.channels);
+    std::vector<int> columns(size_t(dest.width));
+    std::vector<unsigned> column_weights(size_t(dest.width));
+    for (int x = 0; x < dest.width; x++) {
+        auto position = sample_position(x, left, scale_x, source.width);
+        columns[x] = int(position);
+        column_weights[x] = fraction_weight(position, columns[x]);
+    }
+    auto first = columns.front();
+    auto last = std::min(columns.back() + 1, source.width - 1);
+    auto span = size_t(last - first + 1) * channels;
+    std::vector<uint8_t> blended(span);
+
+    for (int y = 0; y < dest.height; y++) {
+        auto position = sample_position(y, top, scale_y, source.height);
+        auto row = int(position);
+        auto below = std::min(row + 1, source.height - 1);
+        blend_rows(source.row(row) + first * channels, source.row(below) + first * channels,
+                   blended.data(), span, fraction_weight(position, row));
+
+        auto out = dest.row(y);
+        for (int x = 0; x < dest.width; x++) {
+            auto weight = column_weights[x];
+            auto inverse = 256 - weight;
+            auto a = blended.data() + size_t(columns[x] - first) * channels;
+            auto b = blended.data() + size_t(std::min(columns[x] + 1, last) - first) * channels;
+            for (size_t c = 0; c < channels; c++) {
+                out[c] = uint8_t((a[c] * inverse + b[c] * weight + 128) >> 8);
+            }
+            out += channels;
+        }
+    }
+}
+
+/**
+ * Source pixels [start, end) under destination pixel i, at least one.
+ */
+void box_span(int i, int offset, double scale, int size, int &start, int &end) {
+    start = std::clamp(int(std::floor((offset + i) / scale)), 0, size - 1);
+    end = std::clamp(int(std::floor((offset + i + 1) / scale)), start + 1, size);
+}
+
+void resample_box(const ImageBuffer &source, const ImageBuffer &dest, int left, int top,
+                  double scale_x, double scale_y) {
+    auto channels = size_t(dest.channels);
+    std::vector<int> starts(size_t(dest.width));
+    std::vector<int> ends(size_t(dest.width));
+    for (int x = 0; x < dest.width; x++) {
+        box_span(x, left, scale_x, source.width, starts[x], ends[x]);
+    }
+    auto first = starts.front();
+    auto span = size_t(ends.back() - first) * channels;
+    std::vector<uint32_t> sums(span);
+
+    for (int y = 0; y < dest.height; y++) {
+        int row_start;
+        int row_end;
+        box_span(y, top, scale_y, source.height, row_start, row_end);
+        std::fill(sums.begin(), sums.end(), 0);
+        for (auto row = row_start; row < row_end; row++) {
+            kernels().accumulate_row(source.row(row) + first * channels, sums.data(), span);
+        }
+
+        auto out = dest.row(y);
+        for (int x = 0; x < dest.width; x++) {
+            auto count = uint32_t(ends[x] - starts[x]) * uint32_t(row_end - row_start);
+            for (size_t c = 0; c < channels; c++) {
+                uint32_t total = 0;
+                for (auto column = starts[x]; column < ends[x]; column++) {
+                    total += sums[size_t(column - first) * channels + c];
+                }
+                out[c] = uint8_t((total + count / 2) / count);
+            }
+            out += channels;
+        }
+    }
+}
+
+}
+
+constexpr int PARALLEL_PIXELS = 1 << 16;
+
+void resample(const ImageBuffer &source, const ImageBuffer &dest, int left, int top,
+              double scale_x, double scale_y, Filter filter) {
+    if (source.width < 1 || source.height < 1 || dest.width < 1 || dest.height < 1) {
+        return;
+    }
+    // bands of at least PARALLEL_PIXELS, tiles are scaled on one thread
+    auto grain = std::max(1, PARALLEL_PIXELS / dest.width);
+    parallel_for(dest.height, grain, [&](int first, int last) {
+        auto band = dest.band(first, last);
+        if (filter == Filter::BOX) {
+            resample_box(source, band, left, top + first, scale_x, scale_y);
+        } else {
+            resample_bilinear(source, band, left, top + first, scale_x, scale_y);
+        }
+    });
+}
+
+const char *resample_kernels() {
+    return kernels().name;
+}
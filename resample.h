@@ -0,0 +1,44 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   resample.h
+ *
+ * Image scaling kernels working on raw 8 bit RGB / RGBA buffers. The inner loops are picked at runtime from AVX2, SSE4.1,
+ * NEON or plain C++.
+ */
+
+#ifndef EOM_RESAMPLE_H
+#define EOM_RESAMPLE_H
+
+#include "image_buffer.h"
+
+enum class Filter {
+    /**
+     * Averages every source pixel under a destination pixel, for scaling down.
+     */
+    BOX,
+    BILINEAR
+};
+
+/**
+ * Fills dest with the part of source scaled by scale_x, scale_y that starts
+ * at left, top. Destination pixel x covers the source pixels from
+ * (left + x) / scale_x to (left + x + 1) / scale_x.
+ * Source and dest must have the same number of channels. Large images are
+ * split into bands scaled on all cores.
+ */
+void resample(const ImageBuffer &source, const ImageBuffer &dest, int left, int top,
+              double scale_x, double scale_y, Filter filter);
+
+/**
+ * @return the name of the kernel set in use, "avx2", "sse4.1", "neon" or "scalar".
+ */
+const char *resample_kernels();
+
+#endif
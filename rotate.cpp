@@ -0,0 +1,215 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   rotate.cpp
+ *
+ * A quarter turn reads the source down its columns, which misses the cache on
+ * every pixel of a large image. The destination is therefore filled in
+ * BLOCK x BLOCK squares whose source rows all stay cached. RGBA squares are
+ * moved 4x4 pixels at a time with a register transpose.
+ */
+
+#include "rotate.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#define EOM_ROTATE_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define EOM_ROTATE_NEON
+#endif
+
+namespace {
+
+constexpr int BLOCK = 64;
+
+/**
+ * Source pixel that ends up at x, y of the destination.
+ */
+template<int CHANNELS>
+const uint8_t *source_pixel(const ImageBuffer &source, Rotation rotation, int x, int y) {
+    switch (rotation) {
+        case Rotation::COUNTERCLOCKWISE:
+            return source.row(x) + size_t(source.width - 1 - y) * CHANNELS;
+        case Rotation::CLOCKWISE:
+            return source.row(source.height - 1 - x) + size_t(y) * CHANNELS;
+        case Rotation::UPSIDE_DOWN:
+            return source.row(source.height - 1 - y) + size_t(source.width - 1 - x) * CHANNELS;
+        default:
+            return source.row(y) + size_t(x) * CHANNELS;
+    }
+}
+
+/**
+ * Destination pixels [x0, x1) x [y0, y1), one at a time.
+ */
+template<int CHANNELS>
+void rotate_pixels(const ImageBuffer &source, const ImageBuffer &dest, Rotation rotation,
+                   int x0, int y0, int x1, int y1) {
+    for (auto y = y0; y < y1; y++) {
+        auto out = dest.row(y) + size_t(x0) * CHANNELS;
+        for (auto x = x0; x < x1; x++) {
+            std::memcpy(out, source_pixel<CHANNELS>(source, rotation, x, y), CHANNELS);
+            out += CHANNELS;
+        }
+    }
+}
+
+#if defined(EOM_ROTATE_SSE2)
+
+using Quad = __m128i;
+
+Quad load(const uint8_t *pixels) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels));
+}
+
+void store(uint8_t *pixels, Quad quad) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels), quad);
+}
+
+Quad reversed(Quad quad) {
+    return _mm_shuffle_epi32(quad, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+void transpose(Quad rows[4]) {
+    auto r0 = _mm_castsi128_ps(rows[0]);
+    auto r1 = _mm_castsi128_ps(rows[1]);
+    auto r2 = _mm_castsi128_ps(rows[2]);
+    auto r3 = _mm_castsi128_ps(rows[3]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    rows[0] = _mm_castps_si128(r0);
+    rows[1] = _mm_castps_si128(r1);
+    rows[2] = _mm_castps_si128(r2);
+    rows[3] = _mm_castps_si128(r3);
+}
+
+#elif defined(EOM_ROTATE_NEON)
+
+using Quad = uint32x4_t;
+
+Quad load(const uint8_t *pixels) {
+    return vreinterpretq_u32_u8(vld1q_u8(pixels));
+}
+
+void store(uint8_t *pixels, Quad quad) {
+    vst1q_u8(pixels, vreinterpretq_u8_u32(quad));
+}
+
+Quad reversed(Quad quad) {
+    auto pairs_swapped = vrev64q_u32(quad);
+    return vcombine_u32(vget_high_u32(pairs_swapped), vget_low_u32(pairs_swapped));
+}
+
+void transpose(Quad rows[4]) {
+    auto top = vtrnq_u32(rows[0], rows[1]);
+    auto bottom = vtrnq_u32(rows[2], rows[3]);
+    rows[0] = vcombine_u32(vget_low_u32(top.val[0]), vget_low_u32(bottom.val[0]));
+    rows[1] = vcombine_u32(vget_low_u32(top.val[1]), vget_low_u32(bottom.val[1]));
+    rows[2] = vcombine_u32(vget_high_u32(top.val[0]), vget_high_u32(bottom.val[0]));
+    rows[3] = vcombine_u32(vget_high_u32(top.val[1]), vget_high_u32(bottom.val[1]));
+}
+
+#endif
+
+#if defined(EOM_ROTATE_SSE2) || defined(EOM_ROTATE_NEON)
+
+/**
+ * The 4x4 RGBA destination pixels starting at x, y.
+ */
+void rotate_quad(const ImageBuffer &source, const ImageBuffer &dest, Rotation rotation, int x, int y) {
+    Quad rows[4];
+    switch (rotation) {
+        case Rotation::COUNTERCLOCKWISE: {
+            auto column = size_t(source.width - 4 - y) * 4;
+            for (int i = 0; i < 4; i++) {
+                rows[i] = load(source.row(x + i) + column);
+            }
+            transpose(rows);
+            for (int i = 0; i < 4; i++) {
+                store(dest.row(y + i) + size_t(x) * 4, rows[3 - i]);
+            }
+            break;
+        }
+        case Rotation::CLOCKWISE: {
+            auto first_row = source.height - 4 - x;
+            for (int i = 0; i < 4; i++) {
+                rows[i] = load(source.row(first_row + i) + size_t(y) * 4);
+            }
+            transpose(rows);
+            for (int i = 0; i < 4; i++) {
+                store(dest.row(y + i) + size_t(x) * 4, reversed(rows[i]));
+            }
+            break;
+        }
+        case Rotation::UPSIDE_DOWN: {
+            auto column = size_t(source.width - 4 - x) * 4;
+            for (int i = 0; i < 4; i++) {
+                store(dest.row(y + i) + size_t(x) * 4, reversed(load(source.row(source.height - 1 - y - i) + column)));
+            }
+            break;
+        }
+        default:
+            for (int i = 0; i < 4; i++) {
+                store(dest.row(y + i) + size_t(x) * 4, load(source.row(y + i) + size_t(x) * 4));
+            }
+    }
+}
+
+#endif
+
+template<int CHANNELS>
+void rotate_block(const ImageBuffer &source, const ImageBuffer &dest, Rotation rotation,
+                  int x0, int y0, int x1, int y1) {
+    rotate_pixels<CHANNELS>(source, dest, rotation, x0, y0, x1, y1);
+}
+
+#if defined(EOM_ROTATE_SSE2) || defined(EOM_ROTATE_NEON)
+
+template<>
+void rotate_block<4>(const ImageBuffer &source, const ImageBuffer &dest, Rotation rotation,
+                     int x0, int y0, int x1, int y1) {
+    auto quads_x1 = x0 + (x1 - x0) / 4 * 4;
+    auto quads_y1 = y0 + (y1 - y0) / 4 * 4;
+    for (auto y = y0; y < quads_y1; y += 4) {
+        for (auto x = x0; x < quads_x1; x += 4) {
+            rotate_quad(source, dest, rotation, x, y);
+        }
+    }
+    rotate_pixels<4>(source, dest, rotation, quads_x1, y0, x1, quads_y1);
+    rotate_pixels<4>(source, dest, rotation, x0, quads_y1, x1, y1);
+}
+
+#endif
+
+template<int CHANNELS>
+void rotate_band(const ImageBuffer &source, const ImageBuffer &dest, Rotation rotation, int first, int last) {
+    for (auto y = first; y < last; y += BLOCK) {
+        for (auto x = 0; x < dest.width; x += BLOCK) {
+            rotate_block<CHANNELS>(source, dest, rotation, x, y, std::min(x + BLOCK, dest.width),
+                                   std::min(y + BLOCK, last));
+        }
+    }
+}
+
+}
+
+void rotate(const ImageBuffer &source, const ImageBuffer &dest, Rotation rotation) {
+    parallel_for(dest.height, BLOCK, [&](int first, int last) {
+        if (source.channels == 4) {
+            rotate_band<4>(source, dest, rotation, first, last);
+        } else {
+            rotate_band<3>(source, dest, rotation, first, last);
+        }
+    });
+}
@@ -0,0 +1,34 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   rotate.h
+ */
+
+#ifndef EOM_ROTATE_H
+#define EOM_ROTATE_H
+
+#include "image_buffer.h"
+
+/**
+ * Counterclockwise degrees, the values of Gdk::PixbufRotation.
+ */
+enum class Rotation {
+    NONE = 0,
+    COUNTERCLOCKWISE = 90,
+    UPSIDE_DOWN = 180,
+    CLOCKWISE = 270
+};
+
+/**
+ * Writes source turned by rotation into dest, which must have the turned
+ * size and the same number of channels. Bands of dest are filled on all cores.
+ */
+void rotate(const ImageBuffer &source, const ImageBuffer &dest, Rotation rotation);
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   scan_index.cpp
+ *
+ * The file is a header, the root, then one record per directory, all in
+ * native byte order since it never leaves the machine. A record is its
+ * fixed part followed by the directory path and the accepted file names
+ * and subdirectory names, each NUL terminated. Records start 8 byte
+ * aligned so they can be read in place.
+ */
+
+#include "scan_index.h"
+#include "atomic_file.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+#ifdef DEBUG_EOM
+#include <iostream>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char MAGIC[8] = {'E', 'O', 'M', 'I', 'N', 'D', 'E', 'X'};
+constexpr uint32_t VERSION = 2;
+/**
+ * Directories changed this close to the index being written may have
+ * changed again within the same mtime tick, FAT counts in 2 s steps.
+ */
+constexpr int64_t RACY_SECONDS = 2;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t root_length;
+    uint64_t key;
+    uint64_t directory_count;
+    /**
+     * When the index was written.
+     */
+    int64_t seconds;
+    int64_t nanoseconds;
+};
+
+struct Record {
+    int64_t seconds;
+    int64_t nanoseconds;
+    uint32_t path_length;
+    uint32_t name_count;
+    uint32_t subdirectory_count;
+    /**
+     * Of the path and names after the record, without padding.
+     */
+    uint32_t bytes;
+};
+
+size_t aligned(size_t offset) {
+    return (offset + 7) & ~size_t(7);
+}
+
+/**
+ * $XDG_CACHE_HOME/eom, created if needed, or empty without a home.
+ */
+std::string cache_directory() {
+    std::string base;
+    if (auto cache = std::getenv("XDG_CACHE_HOME"); cache && *cache == '/') {
+        base = cache;
+    } else if (auto home = std::getenv("HOME"); home && *home) {
+        base = std::string(home) + "/.cache";
+    } else {
+        return "";
+    }
+    mkdir(base.c_str(), 0700);
+    auto directory = base + "/eom";
+    mkdir(directory.c_str(), 0700);
+    return directory;
+}
+
+void append_bytes(std::string &out, const void *bytes, size_t size) {
+    out.append(static_cast<const char *>(bytes), size);
+}
+
+void pad(std::string &out) {
+    out.resize(aligned(out.size()), '\0');
+}
+
+/**
+ * Copies count NUL terminated names from text to names.
+ *
+ * @return false if they run past end
+ */
+bool read_names(const char *&text, const char *end, uint32_t count, std::vector<std::string> &names) {
+    names.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        auto nul = static_cast<const char *>(std::memchr(text, '\0', size_t(end - text)));
+        if (!nul) {
+            return false;
+        }
+        names.emplace_back(text, nul);
+        text = nul + 1;
+    }
+    return true;
+}
+
+}
+
+ScanIndex::ScanIndex(std::string root, uint64_t key) : root(std::move(root)), key(key) {
+    auto directory = cache_directory();
+    if (directory.empty()) {
+        return;
+    }
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.index", static_cast<unsigned long long>(hash(this->root)));
+    path = directory + name;
+    load();
+}
+
+ScanIndex::~ScanIndex() {
+    if (mapped) {
+        munmap(const_cast<char *>(mapped), mapped_size);
+    }
+}
+
+uint64_t ScanIndex::hash(std::string_view bytes, uint64_t seed) {
+    for (auto c: bytes) {
+        seed = (seed ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+    }
+    return seed;
+}
+
+void ScanIndex::load() {
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat status{};
+    if (fstat(fd, &status) != 0 || size_t(status.st_size) < sizeof(Header)) {
+        close(fd);
+        return;
+    }
+    auto size = size_t(status.st_size);
+    auto memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return;
+    }
+    mapped = static_cast<const char *>(memory);
+    mapped_size = size;
+
+    Header header{};
+    std::memcpy(&header, mapped, sizeof(header));
+    auto offset = sizeof(Header);
+    auto valid = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION &&
+                 header.key == key && header.root_length <= size - offset &&
+                 std::string_view(mapped + offset, header.root_length) == root;
+    offset = aligned(offset + header.root_length);
+    for (uint64_t i = 0; valid && i < header.directory_count; i++) {
+        if (offset + sizeof(Record) > size) {
+            valid = false;
+            break;
+        }
+        auto record = reinterpret_cast<const Record *>(mapped + offset);
+        auto body = offset + sizeof(Record);
+        if (record->bytes > size - body || record->path_length > record->bytes) {
+            valid = false;
+            break;
+        }
+        // like git's racy entries, a directory not clearly older than the
+        // index may have changed after it was read without a new mtime
+        auto racy = record->seconds > header.seconds - RACY_SECONDS ||
+                    (record->seconds == header.seconds - RACY_SECONDS &&
+                     record->nanoseconds >= header.nanoseconds);
+        if (!racy) {
+            records.emplace(std::string_view(mapped + body, record->path_length), offset);
+        }
+        offset = aligned(body + record->bytes);
+    }
+    if (!valid) {
+#ifdef DEBUG_EOM
+        std::cerr << "ignoring index " << path << "\n";
+#endif
+        records.clear();
+        munmap(memory, size);
+        mapped = nullptr;
+        mapped_size = 0;
+    }
+}
+
+bool ScanIndex::find(const std::string &directory, const timespec &modified, DirScanner::Batch &batch) const {
+    auto found = records.find(directory);
+    if (found == records.end()) {
+        return false;
+    }
+    auto record = reinterpret_cast<const Record *>(mapped + found->second);
+    if (record->seconds != modified.tv_sec || record->nanoseconds != modified.tv_nsec) {
+        return false;
+    }
+    auto text = reinterpret_cast<const char *>(record + 1);
+    auto end = text + record->bytes;
+    text += record->path_length;
+    batch.names.clear();
+    batch.subdirectories.clear();
+    return read_names(text, end, record->name_count, batch.names) &&
+           read_names(text, end, record->subdirectory_count, batch.subdirectories);
+}
+
+void ScanIndex::record(const DirScanner::Batch &batch) {
+    std::lock_guard<std::mutex> lock(record_mutex);
+    recorded.push_back(batch);
+}
+
+void ScanIndex::save() {
+    if (path.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(record_mutex);
+    std::string out;
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.root_length = uint32_t(root.size());
+    header.key = key;
+    header.directory_count = recorded.size();
+    timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    header.seconds = now.tv_sec;
+    header.nanoseconds = now.tv_nsec;
+    append_bytes(out, &header, sizeof(header));
+    out += root;
+    pad(out);
+    for (auto &batch: recorded) {
+        Record record{batch.modified.tv_sec, batch.modified.tv_nsec, uint32_t(batch.directory.size()),
+                      uint32_t(batch.names.size()), uint32_t(batch.subdirectories.size()), 0};
+        auto start = out.size();
+        append_bytes(out, &record, sizeof(record));
+        out += batch.directory;
+        for (auto names: {&batch.names, &batch.subdirectories}) {
+            for (auto &name: *names) {
+                out.append(name.c_str(), name.size() + 1);
+            }
+        }
+        record.bytes = uint32_t(out.size() - start - sizeof(record));
+        std::memcpy(&out[start], &record, sizeof(record));
+        pad(out);
+    }
+    try {
+        AtomicFile file(path);
+        for (size_t written = 0; written < out.size();) {
+            auto count = write(file.fd, out.data() + written, out.size() - written);
+            if (count < 0) {
+                throw std::runtime_error("Could not write " + file.temp_path() + ": " + std::strerror(errno));
+            }
+            written += size_t(count);
+        }
+        file.commit();
+    } catch (std::runtime_error &error) {
+#ifdef DEBUG_EOM
+        std::cerr << error.what() << "\n";
+#endif
+    }
+}
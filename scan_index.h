@@ -0,0 +1,90 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   scan_index.h
+ */
+
+#ifndef EOM_SCAN_INDEX_H
+#define EOM_SCAN_INDEX_H
+
+#include "dir_scanner.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * What the last scan of a root found, kept in a file under the XDG cache
+ * directory. The file is mapped and only the records of directories that
+ * are asked for get copied out. A directory whose modification time is
+ * unchanged has the same entries, so reopening a tree costs a stat per
+ * directory instead of reading and filtering every file. Directories
+ * modified shortly before the index was written are read again, their
+ * mtime may not show a later change. Only filters that go by name alone
+ * can use it.
+ *
+ * find() may be called from the scanning threads while record() collects
+ * their batches for the next save().
+ */
+struct ScanIndex {
+    /**
+     * @param root the scanned directory
+     * @param key identifies what the scan accepts, an index made with
+     * another key is ignored
+     */
+    ScanIndex(std::string root, uint64_t key);
+
+    ScanIndex(const ScanIndex &) = delete;
+
+    ScanIndex &operator=(const ScanIndex &) = delete;
+
+    ~ScanIndex();
+
+    /**
+     * FNV-1a, stable across runs, for keys and file names.
+     */
+    static uint64_t hash(std::string_view bytes, uint64_t seed = 0xcbf29ce484222325ull);
+
+    /**
+     * Fits DirScanner::Known.
+     */
+    bool find(const std::string &directory, const timespec &modified, DirScanner::Batch &batch) const;
+
+    void record(const DirScanner::Batch &batch);
+
+    /**
+     * Replaces the index file with the recorded batches. Errors are only
+     * logged, the next scan just reads everything again.
+     */
+    void save();
+
+private:
+    /**
+     * Maps the index file, leaves it unmapped if it is missing, stale or
+     * damaged.
+     */
+    void load();
+
+    std::string root;
+    uint64_t key;
+    std::string path;
+    const char *mapped = nullptr;
+    size_t mapped_size = 0;
+    /**
+     * Offsets of the records in mapped, by directory.
+     */
+    std::unordered_map<std::string_view, size_t> records;
+    std::vector<DirScanner::Batch> recorded;
+    std::mutex record_mutex;
+};
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   sniff.cpp
+ */
+
+#include "sniff.h"
+
+#include <cstring>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+struct Signature {
+    size_t offset;
+    std::string_view bytes;
+    /**
+     * Name of the gdk-pixbuf loader that reads it.
+     */
+    std::string_view format;
+};
+
+using namespace std::string_view_literals;
+
+const Signature SIGNATURES[] = {
+        {0, "\xFF\xD8\xFF"sv, "jpeg"},
+        {0, "\x89PNG\r\n\x1A\n"sv, "png"},
+        {0, "GIF87a"sv, "gif"},
+        {0, "GIF89a"sv, "gif"},
+        {0, "BM"sv, "bmp"},
+        {0, "II*\0"sv, "tiff"}, // little endian
+        {0, "MM\0*"sv, "tiff"},
+        {8, "WEBP"sv, "webp"}, // after RIFF and a size
+        {0, "\0\0\1\0"sv, "ico"},
+        {0, "\0\0\2\0"sv, "ico"}, // cur
+        {0, "icns"sv, "icns"},
+        {0, "/* XPM */"sv, "xpm"},
+        {4, "ftypheic"sv, "heif"},
+        {4, "ftypheix"sv, "heif"},
+        {4, "ftypmif1"sv, "heif"},
+        {4, "ftypavif"sv, "avif"},
+        // libheif reads AVIF too
+        {4, "ftypavif"sv, "heif"},
+        {0, "\xFF\x0A"sv, "jxl"}, // codestream
+        {0, "\0\0\0\x0CJXL "sv, "jxl"}, // container
+};
+
+bool starts_with(const uint8_t *head, size_t size, const Signature &signature) {
+    return size >= signature.offset + signature.bytes.size() &&
+           std::memcmp(head + signature.offset, signature.bytes.data(), signature.bytes.size()) == 0;
+}
+
+/**
+ * P1 to P7, followed by white space.
+ */
+bool is_netpbm(const uint8_t *head, size_t size) {
+    return size >= 3 && head[0] == 'P' && head[1] >= '1' && head[1] <= '7' &&
+           (head[2] == ' ' || head[2] == '\n' || head[2] == '\r' || head[2] == '\t');
+}
+
+/**
+ * SVG has no fixed start, look for the root element after the XML prolog.
+ */
+bool is_svg(const uint8_t *head, size_t size) {
+    std::string_view text(reinterpret_cast<const char *>(head), size);
+    return text.find("<svg") != std::string_view::npos;
+}
+
+}
+
+bool has_image_signature(const uint8_t *head, size_t size, const ExtensionSet &formats) {
+    if (size > SNIFF_SIZE) {
+        size = SNIFF_SIZE;
+    }
+    for (auto &signature: SIGNATURES) {
+        if (formats.contains(signature.format) && starts_with(head, size, signature)) {
+            return true;
+        }
+    }
+    return (formats.contains("pnm") && is_netpbm(head, size)) || (formats.contains("svg") && is_svg(head, size));
+}
+
+bool sniff_image(int directory_fd, const char *name, const ExtensionSet &formats) {
+    // a FIFO or device would block or have side effects on open
+    auto fd = openat(directory_fd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC | O_NOCTTY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status{};
+    if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode)) {
+        close(fd);
+        return false;
+    }
+    uint8_t head[SNIFF_SIZE];
+    auto size = pread(fd, head, sizeof(head), 0);
+    close(fd);
+    return size > 0 && has_image_signature(head, size_t(size), formats);
+}
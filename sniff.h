@@ -0,0 +1,45 @@
+/*
+ * Attribution-ShareAlike 4.0 International (CC BY-SA 4.0)
+ * You are free to:
+ * Share — copy and redistribute the material in any medium or format
+ * Adapt — remix, transform, and build upon the material
+ * for any purpose, even commercially.
+ */
+
+/*
+ * File:   sniff.h
+ *
+ * Recognizes images by their first bytes instead of their names.
+ */
+
+#ifndef EOM_SNIFF_H
+#define EOM_SNIFF_H
+
+#include "extension_set.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Bytes read from the start of a file, enough for every signature.
+ */
+constexpr size_t SNIFF_SIZE = 256;
+
+/**
+ * @param head the first size bytes of a file, at most SNIFF_SIZE are looked at
+ * @param formats names of the gdk-pixbuf loaders installed, as gdk_pixbuf_format_get_name() gives them
+ * @return true if they start like an image one of formats reads
+ */
+bool has_image_signature(const uint8_t *head, size_t size, const ExtensionSet &formats);
+
+/**
+ * Reads the start of name with a single pread and checks it with
+ * has_image_signature(). Never blocks on a FIFO or device, only regular
+ * files are read.
+ *
+ * @param directory_fd directory name is in, or AT_FDCWD for a path
+ * @return false if the file can't be read or is not a regular file
+ */
+bool sniff_image(int directory_fd, const char *name, const ExtensionSet &formats);
+
+#endif